@@ -0,0 +1,332 @@
+//-------------------------------------------------------------------------
+//
+// Run a directory of BASIC programs and keep what they print.
+//
+//   nascom-batch [-j workers] [-n cycles] [-v] directory
+//
+// Each foo.bas is run on a fresh machine and whatever it prints is written
+// to foo.out next to it. A program stops when BASIC says Ok again, when it
+// asks for input (there isn't any), or after cycles T-states (default
+// 100M, about 25 seconds of a 4MHz NASCOM).
+//
+// NAS-SYS is booted into BASIC once, and every job starts from a copy of
+// that machine. Nothing goes through the keyboard: BASIC reads its lines
+// with the monitor's INLIN, which asks the IN routine for each character,
+// so the program text is handed straight to IN calls. Output is caught
+// the same way, at the ROUT restart. A program goes in as fast as BASIC
+// can take it.
+//
+// The jobs are spread over the workers, one per core unless -j says
+// otherwise. Like the server, this is built with NASCOM_THREADS so each
+// worker thread has a machine of its own.
+//
+//-------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "memory.h"
+#include "ports.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+// The NAS-SYS entry points that are watched. SCAL is followed by a byte
+// saying which routine to call.
+
+const uint16_t ScalRestart = 0x18;
+const uint8_t  ScalIn      = 0x62;		// Carry and a character in A, if any
+const uint16_t RoutRestart = 0x30;		// Print the character in A
+
+enum JobStatus
+{
+	JobDone,
+	JobInput,			// Waiting for input that will never come
+	JobTimedOut,
+};
+
+static const char *statusNames[] = { "ok", "input", "timeout" };
+
+struct Snapshot
+{
+	uint8_t			*ram;
+	Z80Registers	regs;
+	uint64_t		cycles;
+};
+
+static Snapshot ready;					// BASIC at its first Ok
+static uint64_t cycleLimit = 100000000;
+
+
+//-------------------------------------------------------------------------
+//
+// Run the current machine, feeding it input until there's none left and
+// it asks for more. Everything printed after the last of the input is
+// returned in output, with the echo of the final return and BASIC's Ok
+// taken off.
+//
+//-------------------------------------------------------------------------
+
+static JobStatus run(const string &input, string &output)
+{
+	uint64_t end = z80cycles() + cycleLimit;
+	size_t next = 0;
+	Z80Registers r;
+
+	output.clear();
+
+	while (z80cycles() < end)
+	{
+		uint16_t pc = z80pc();
+
+		if (pc == RoutRestart && next == input.size())
+		{
+			z80getRegisters(r);
+			output += char(r.af >> 8);
+		}
+		else if (pc == ScalRestart)
+		{
+			z80getRegisters(r);
+			uint16_t ret = readRam(r.sp) | (readRam(r.sp + 1) << 8);
+
+			if (readRam(ret) == ScalIn)
+			{
+				if (next == input.size())
+				{
+					if (output.size() >= 3 && output.compare(output.size() - 3, 3, "Ok\r") == 0)
+					{
+						output.erase(output.size() - 3);
+						if (!output.empty() && output[0] == '\r')
+							output.erase(0, 1);
+						return JobDone;
+					}
+
+					return JobInput;
+				}
+
+				// Return from the SCAL with the character
+
+				r.af = (uint8_t(input[next++]) << 8) | (r.af & 0xff) | 0x01;
+				r.sp += 2;
+				r.pc = ret + 1;
+				z80setRegisters(r);
+				continue;
+			}
+		}
+
+		z80step();
+	}
+
+	return JobTimedOut;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Get BASIC to its first Ok and keep the machine.
+//
+//-------------------------------------------------------------------------
+
+static void prepareSnapshot()
+{
+	loadNasFile("nassys3.nal");
+	loadNasFile("nastest.nal");
+	loadNasFile("basic.nal");
+	shareRoms();
+	setHeadless();
+
+	// Cold start BASIC and take the default memory size
+
+	string output;
+
+	if (run("J\r\r", output) != JobDone)
+	{
+		cerr << "BASIC didn't start" << endl;
+		exit(1);
+	}
+
+	ready.ram = newMemory();
+	z80getRegisters(ready.regs);
+	ready.cycles = z80cycles();
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The jobs.
+//
+//-------------------------------------------------------------------------
+
+struct Job
+{
+	string		path;
+	JobStatus	status;
+	uint64_t	cycles;
+};
+
+static vector<Job> jobs;
+static atomic<size_t> nextJob(0);
+static bool verbose = false;
+
+static string outputPath(const string &path)
+{
+	return path.substr(0, path.size() - 4) + ".out";
+}
+
+static void runJob(Job &job)
+{
+	ifstream f(job.path);
+	stringstream text;
+	text << f.rdbuf();
+
+	// BASIC wants a return at the end of each line, then RUN it
+
+	string input;
+	for (char ch : text.str())
+	{
+		if (ch == '\n')
+			input += '\r';
+		else if (ch != '\r')
+			input += ch;
+	}
+
+	if (!input.empty() && input.back() != '\r')
+		input += '\r';
+	input += "RUN\r";
+
+	uint8_t *ram = newMemory(ready.ram);
+	useMemory(ram);
+	z80setRegisters(ready.regs);
+	z80setCycles(ready.cycles);
+
+	string output;
+	job.status = run(input, output);
+	job.cycles = z80cycles() - ready.cycles;
+
+	replace(output.begin(), output.end(), '\r', '\n');
+	ofstream(outputPath(job.path)) << output;
+
+	deleteMemory(ram);
+}
+
+static void worker()
+{
+	useKeyboard(newKeyboard());
+
+	size_t index;
+	while ((index = nextJob++) < jobs.size())
+		runJob(jobs[index]);
+}
+
+static void findJobs(const string &dir)
+{
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+	{
+		cerr << "Cannot open " << dir << endl;
+		exit(1);
+	}
+
+	while (dirent *entry = readdir(d))
+	{
+		string name = entry->d_name;
+		if (name.size() > 4 && name.compare(name.size() - 4, 4, ".bas") == 0)
+			jobs.push_back({ dir + "/" + name, JobTimedOut, 0 });
+	}
+
+	closedir(d);
+
+	sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.path < b.path; });
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Start up.
+//
+//-------------------------------------------------------------------------
+
+static void usage()
+{
+	cerr << "Usage: nascom-batch [-j workers] [-n cycles] [-v] directory" << endl;
+	cerr << "  -j workers  worker threads (default one per core)" << endl;
+	cerr << "  -n cycles   T-states each program can run for (default 100M)" << endl;
+	cerr << "  -v          list how each program went" << endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned workers = thread::hardware_concurrency();
+	int c;
+
+	while ((c = getopt(argc, argv, "j:n:v")) != -1)
+	{
+		switch (c)
+		{
+		case 'j':
+			workers = atoi(optarg);
+			break;
+		case 'n':
+			cycleLimit = strtoull(optarg, nullptr, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1)
+		usage();
+
+	if (workers == 0)
+		workers = 1;
+
+	findJobs(argv[optind]);
+	prepareSnapshot();
+
+	auto start = chrono::steady_clock::now();
+
+	vector<thread> threads;
+	for (unsigned i = 0; i < workers; ++i)
+		threads.emplace_back(worker);
+	for (thread &t : threads)
+		t.join();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// Report
+
+	int counts[3] = { 0, 0, 0 };
+	uint64_t cycles = 0;
+
+	for (const Job &job : jobs)
+	{
+		++counts[job.status];
+		cycles += job.cycles;
+
+		if (verbose)
+			cout << job.path << ": " << statusNames[job.status] << ", " << job.cycles << " T-states" << endl;
+	}
+
+	cout << jobs.size() << " programs, " << counts[JobDone] << " finished, "
+		 << counts[JobInput] << " waiting for input, " << counts[JobTimedOut] << " timed out" << endl;
+	cout << seconds << "s, " << (seconds > 0 ? jobs.size() / seconds : 0) << " jobs/s, "
+		 << (seconds > 0 ? cycles / seconds / 1e6 : 0) << "M T-states/s on "
+		 << workers << " workers" << endl;
+
+	return counts[JobDone] == (int) jobs.size() ? 0 : 1;
+}
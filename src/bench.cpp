@@ -0,0 +1,249 @@
+//-------------------------------------------------------------------------
+//
+// Microbenchmark for the Z80 core. Drives z80step() over small generated
+// instruction loops, one per opcode group, and reports what each group
+// costs on the host.
+//
+// Memory is a flat 64K with no ROM protection and no video trap, so we
+// only measure the core itself. The Makefile links one bench-<engine>
+// binary per dispatch engine so they can be compared side by side.
+//
+//-------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <vector>
+
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+static uint8_t ram[64*1024];
+
+extern "C" uint8_t readRam(uint16_t addr)				{ return ram[addr]; }
+extern "C" void    writeRam(uint16_t addr, uint8_t val)	{ ram[addr] = val; }
+extern "C" uint8_t portIn(uint8_t port)					{ return 0xff; }
+extern "C" void    portOut(uint8_t port, uint8_t val)	{ }
+
+// No fast paths, so the block group times the emulator's own loops
+
+extern "C" int      copyRam(uint16_t, uint16_t, unsigned, int)		{ return -1; }
+extern "C" unsigned findRam(uint16_t, unsigned, uint8_t, int)		{ return 0; }
+extern "C" unsigned portInBlock(uint8_t, uint16_t, unsigned, int)	{ return 0; }
+extern "C" unsigned portOutBlock(uint8_t, uint16_t, unsigned, int)	{ return 0; }
+
+
+//-------------------------------------------------------------------------
+//
+// Each group is a loop body placed at LoopStart which ends in a jump back
+// to LoopStart. Every group shares the same prologue at address 0 which
+// sets up the stack and points the register pairs at scratch memory well
+// away from the code.
+//
+//-------------------------------------------------------------------------
+
+const uint16_t LoopStart = 0x0100;
+
+struct Fragment
+{
+	uint16_t		addr;
+	vector<uint8_t>	bytes;
+};
+
+struct Group
+{
+	const char		 *name;
+	vector<Fragment>  code;
+};
+
+static const vector<uint8_t> prologue =
+{
+	0x31, 0x00, 0xf0,			// LD SP,F000
+	0x21, 0x00, 0x80,			// LD HL,8000
+	0x01, 0x34, 0x12,			// LD BC,1234
+	0x11, 0x78, 0x56,			// LD DE,5678
+	0xdd, 0x21, 0x00, 0x80,		// LD IX,8000
+	0xfd, 0x21, 0x00, 0x81,		// LD IY,8100
+	0x3e, 0x01,					// LD A,01
+	0xb7,						// OR A
+	0xc3, 0x00, 0x01,			// JP LoopStart
+};
+
+const int PrologueSteps = 9;
+
+static const vector<Group> groups =
+{
+	{ "alu", {
+		{ LoopStart, {
+			0x80,					// ADD A,B
+			0x89,					// ADC A,C
+			0x92,					// SUB D
+			0x9b,					// SBC A,E
+			0xa4,					// AND H
+			0xad,					// XOR L
+			0xb0,					// OR B
+			0xb9,					// CP C
+			0x04,					// INC B
+			0x0d,					// DEC C
+			0x3c,					// INC A
+			0x86,					// ADD A,(HL)
+			0xc6, 0x11,				// ADD A,11
+			0xee, 0x5a,				// XOR 5A
+			0x27,					// DAA
+			0xc3, 0x00, 0x01,		// JP LoopStart
+		} },
+	} },
+
+	{ "cb", {
+		{ LoopStart, {
+			0xcb, 0x00,				// RLC B
+			0xcb, 0x09,				// RRC C
+			0xcb, 0x12,				// RL D
+			0xcb, 0x1b,				// RR E
+			0xcb, 0x27,				// SLA A
+			0xcb, 0x3f,				// SRL A
+			0xcb, 0x5a,				// BIT 3,D
+			0xcb, 0xe3,				// SET 4,E
+			0xcb, 0xaf,				// RES 5,A
+			0xcb, 0x46,				// BIT 0,(HL)
+			0xcb, 0xfe,				// SET 7,(HL)
+			0xcb, 0x2f,				// SRA A
+			0xc3, 0x00, 0x01,		// JP LoopStart
+		} },
+	} },
+
+	{ "index", {
+		{ LoopStart, {
+			0xdd, 0x7e, 0x05,		// LD A,(IX+5)
+			0xfd, 0x86, 0xfd,		// ADD A,(IY-3)
+			0xdd, 0x70, 0x01,		// LD (IX+1),B
+			0xfd, 0x34, 0x02,		// INC (IY+2)
+			0xdd, 0x23,				// INC IX
+			0xdd, 0x2b,				// DEC IX
+			0xdd, 0xe5,				// PUSH IX
+			0xdd, 0xe1,				// POP IX
+			0xdd, 0xcb, 0x03, 0x46,	// BIT 0,(IX+3)
+			0xfd, 0xcb, 0x04, 0xc6,	// SET 0,(IY+4)
+			0xdd, 0x77, 0x06,		// LD (IX+6),A
+			0xfd, 0xbe, 0x07,		// CP (IY+7)
+			0xc3, 0x00, 0x01,		// JP LoopStart
+		} },
+	} },
+
+	{ "block", {
+		{ LoopStart, {
+			0x21, 0x00, 0x80,		// LD HL,8000
+			0x11, 0x00, 0x90,		// LD DE,9000
+			0x01, 0x40, 0x00,		// LD BC,0040
+			0xed, 0xb0,				// LDIR
+			0x21, 0x3f, 0x90,		// LD HL,903F
+			0x11, 0x3f, 0x80,		// LD DE,803F
+			0x01, 0x40, 0x00,		// LD BC,0040
+			0xed, 0xb8,				// LDDR
+			0x21, 0x00, 0x80,		// LD HL,8000
+			0x01, 0x40, 0x00,		// LD BC,0040
+			0x3e, 0xff,				// LD A,FF
+			0xed, 0xb1,				// CPIR
+			0xed, 0xa0,				// LDI
+			0xed, 0xa1,				// CPI
+			0xc3, 0x00, 0x01,		// JP LoopStart
+		} },
+	} },
+
+	{ "call", {
+		{ LoopStart, {
+			0xcd, 0x20, 0x01,		// CALL 0120
+			0xc4, 0x20, 0x01,		// CALL NZ,0120
+			0xef,					// RST 28H
+			0xc5,					// PUSH BC
+			0xd1,					// POP DE
+			0xcd, 0x21, 0x01,		// CALL 0121
+			0xc3, 0x00, 0x01,		// JP LoopStart
+		} },
+		{ 0x0120, {
+			0xc9,					// RET
+			0xb7,					// OR A
+			0xc0,					// RET NZ
+			0xc9,					// RET
+		} },
+		{ 0x0028, {
+			0xc9,					// RET
+		} },
+	} },
+};
+
+
+//-------------------------------------------------------------------------
+//
+// Nanoseconds from a monotonic clock.
+//
+//-------------------------------------------------------------------------
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Load a group into memory, run the prologue to get to the top of the
+// loop, then time a fixed number of instructions.
+//
+//-------------------------------------------------------------------------
+
+static double runGroup(const Group &group, long count)
+{
+	memset(ram, 0, sizeof(ram));
+	memcpy(ram, prologue.data(), prologue.size());
+
+	for (const Fragment &f : group.code)
+		memcpy(&ram[f.addr], f.bytes.data(), f.bytes.size());
+
+	z80reset();
+
+	for (int i = 0; i < PrologueSteps; ++i)
+		z80step();
+
+	double start = now();
+
+	for (long i = 0; i < count; ++i)
+		z80step();
+
+	return (now() - start) / count;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Usage: bench-<engine> [instructions per group]
+//
+//-------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+	long count = (argc > 1) ? atol(argv[1]) : 20000000;
+
+	if (count <= 0)
+	{
+		fprintf(stderr, "usage: %s [instructions per group]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%s, %ld instructions per group\n\n", argv[0], count);
+	printf("%-8s %10s %10s\n", "group", "ns/instr", "MIPS");
+
+	for (const Group &group : groups)
+	{
+		double ns = runGroup(group, count);
+		printf("%-8s %10.2f %10.1f\n", group.name, ns, 1000.0 / ns);
+	}
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+//-------------------------------------------------------------------------
+//
+// The UART and the cassette interface behind it. Port 1 is the UART's
+// data, port 2 its status: bit 7 says a byte has arrived and bit 6 that
+// the last one written has gone. NAS-SYS polls these for the R and W
+// commands, and for the serial line in X mode.
+//
+// Only the tape is emulated, not a serial line, so the tape moves (bytes
+// arrive and written ones are kept) while the motor is on. Otherwise
+// NAS-SYS would see a loaded tape as someone typing at it.
+//
+// A .cas file is just the bytes that go through the UART, streamed
+// through a large stdio buffer. Each byte takes its time at 1200 baud,
+// timed by events on the emulated clock, unless turbo is on, when the
+// UART is always ready and a tape goes as fast as NAS-SYS can take it.
+//
+//-------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "cassette.h"
+#include "events.h"
+#include "ports.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+// A start bit, 8 data bits and a stop bit at 1200 baud, from a 4MHz clock
+
+const uint64_t ByteCycles = 4000000 * 10 / 1200;
+
+const size_t BufferSize = 64*1024;
+
+const uint8_t DataReady   = 0x80;
+const uint8_t SenderEmpty = 0x40;
+
+struct Uart
+{
+	FILE	*in = nullptr;
+	FILE	*out = nullptr;
+	bool	turbo = false;
+
+	bool	received = true;	// The next byte on the tape has had time to arrive
+	bool	sending = false;	// The last byte written is still going out
+	uint8_t	data = 0;			// What was last read
+};
+
+// There's just the one tape deck, only nascom has one
+
+static Uart uart;
+
+
+//-------------------------------------------------------------------------
+//
+// The bytes take a while, unless it's turbo.
+//
+//-------------------------------------------------------------------------
+
+static void byteReceived()
+{
+	uart.received = true;
+}
+
+static void byteSent()
+{
+	uart.sending = false;
+}
+
+static bool dataReady()
+{
+	if (!uart.in || !uart.received || !tapeMotorOn())
+		return false;
+
+	int ch = getc(uart.in);
+	if (ch == EOF)
+		return false;
+
+	ungetc(ch, uart.in);
+	return true;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The ports.
+//
+//-------------------------------------------------------------------------
+
+static uint8_t uartStatus(uint8_t port)
+{
+	return (dataReady() ? DataReady : 0) | (uart.sending ? 0 : SenderEmpty);
+}
+
+static uint8_t uartIn(uint8_t port)
+{
+	if (!dataReady())
+		return uart.data;
+
+	uart.data = getc(uart.in);
+
+	if (!uart.turbo)
+	{
+		uart.received = false;
+		scheduleEvent(z80cycles() + ByteCycles, byteReceived);
+	}
+
+	return uart.data;
+}
+
+static void uartOut(uint8_t port, uint8_t value)
+{
+	if (uart.out && tapeMotorOn())
+		putc(value, uart.out);
+
+	if (!uart.turbo)
+	{
+		uart.sending = true;
+		scheduleEvent(z80cycles() + ByteCycles, byteSent);
+	}
+}
+
+// INIR and OTIR only get the tape in one go when it's turbo, otherwise
+// each byte has to wait its turn
+
+static unsigned uartInBlock(uint8_t port, uint8_t *buffer, unsigned count)
+{
+	if (!uart.turbo || !uart.in || !tapeMotorOn())
+		return 0;
+
+	unsigned done = fread(buffer, 1, count, uart.in);
+	if (done > 0)
+		uart.data = buffer[done - 1];
+
+	return done;
+}
+
+static unsigned uartOutBlock(uint8_t port, const uint8_t *buffer, unsigned count)
+{
+	if (!uart.turbo || !uart.out || !tapeMotorOn())
+		return 0;
+
+	return fwrite(buffer, 1, count, uart.out);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Load the tapes.
+//
+//-------------------------------------------------------------------------
+
+static FILE *openTape(const string &filename, const char *mode)
+{
+	if (filename.empty())
+		return nullptr;
+
+	FILE *f = fopen(filename.c_str(), mode);
+	if (!f)
+	{
+		cerr << "Cannot open tape " << filename << endl;
+		exit(1);
+	}
+
+	setvbuf(f, nullptr, _IOFBF, BufferSize);
+	return f;
+}
+
+void startCassette(const string &in, const string &out, bool turbo)
+{
+	uart.in = openTape(in, "rb");
+	uart.out = openTape(out, "wb");
+	uart.turbo = turbo;
+
+	attachDevice(1, 1, { uartIn, uartOut, uartInBlock, uartOutBlock });
+	attachDevice(2, 2, { uartStatus });
+}
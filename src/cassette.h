@@ -0,0 +1,19 @@
+//-------------------------------------------------------------------------
+//
+// The UART and cassette interface on ports 1 and 2, see cassette.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef CASSETTE_H
+#define CASSETTE_H
+
+#include <string>
+
+// Put the UART on the port bus. NAS-SYS R reads from the tape image in,
+// and W writes to out, either can be empty for no tape. The images are
+// .cas files, just the bytes that went through the UART. Turbo makes the
+// UART ready at once instead of taking a byte's time at 1200 baud.
+
+void startCassette(const std::string &in, const std::string &out, bool turbo);
+
+#endif
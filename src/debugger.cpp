@@ -0,0 +1,480 @@
+//-------------------------------------------------------------------------
+//
+// Interactive debugger. It's driven from a side console, usually another
+// terminal (run "tty" there and pass the name with -g), because the main
+// terminal belongs to the NASCOM screen and keyboard.
+//
+// Commands, addresses are hex or symbol names:
+//
+//   c              continue
+//   s [count]      single-step
+//   r              show the registers
+//   m addr [len]   dump memory
+//   u [addr] [n]   disassemble
+//   b addr         break when PC reaches addr
+//   w addr [last] [r|w|rw]
+//                  break after a read and/or write of an address range
+//   p port         break before an IN or OUT on port
+//   l              list the breakpoints
+//   d              delete all the breakpoints
+//   y              write the RAM out to its file now (see -m)
+//   q              quit
+//
+// debugStep() is only used when the debugger is wanted, the normal run
+// loop is untouched. PC breakpoints are a bitmap over the 64K space, so
+// the check is a single bit test. Watchpoints don't cost anything per
+// access: they hook the memory-map pages they cover, and only accesses
+// to those pages go through the debugger.
+//
+//-------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "debugger.h"
+#include "disasm.h"
+#include "memory.h"
+#include "symbols.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+static FILE *console;						// Output
+static FILE *commands;						// Input
+
+static uint64_t breakMap[64*1024 / 64];		// One bit per address
+static uint64_t portMap[256 / 64];			// One bit per port
+static bool armed = false;					// Any PC or port breakpoints?
+
+enum WatchKind { WatchRead = 1, WatchWrite = 2 };
+
+struct Watch
+{
+	uint16_t	first, last;
+	int			kind;
+};
+
+static vector<Watch> watches;
+static bool running = false;				// Inside z80step()
+static string watchHit;						// Set by the memory hooks
+
+static bool stopRequested = true;			// Start stopped
+static uint64_t stepsLeft = 0;
+static uint32_t pollCount = 0;
+
+static uint16_t listAddr;					// Where "u" carries on from
+
+
+//-------------------------------------------------------------------------
+//
+// Bitmap helpers.
+//
+//-------------------------------------------------------------------------
+
+static inline bool testBit(const uint64_t *map, unsigned bit)
+{
+	return (map[bit >> 6] >> (bit & 63)) & 1;
+}
+
+static inline void setBit(uint64_t *map, unsigned bit)
+{
+	map[bit >> 6] |= uint64_t(1) << (bit & 63);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Memory hooks for the watchpoints. Only the pages with a watch in them
+// call these, so the address still has to be checked.
+//
+//-------------------------------------------------------------------------
+
+static void checkWatch(uint16_t addr, int kind, const char *what)
+{
+	if (!running)
+		return;			// The debugger's own peeking
+
+	for (const Watch &w : watches)
+	{
+		if ((w.kind & kind) && addr >= w.first && addr <= w.last)
+		{
+			char text[32];
+			snprintf(text, sizeof(text), "%s %04X", what, addr);
+			watchHit = text;
+			return;
+		}
+	}
+}
+
+static void watchRead(uint16_t addr)
+{
+	checkWatch(addr, WatchRead, "read");
+}
+
+static void watchWrite(uint16_t addr, uint8_t val)
+{
+	checkWatch(addr, WatchWrite, "write");
+}
+
+
+//-------------------------------------------------------------------------
+//
+// If the instruction at pc does port I/O, return the port, otherwise -1.
+//
+//-------------------------------------------------------------------------
+
+static int ioPort(uint16_t pc)
+{
+	uint8_t op = readRam(pc);
+
+	if (op == 0xd3 || op == 0xdb)		// OUT (n),A and IN A,(n)
+		return readRam(pc + 1);
+
+	if (op != 0xed)
+		return -1;
+
+	op = readRam(pc + 1);
+
+	// IN r,(C), OUT (C),r and the INI/OUTI family
+
+	if ((op & 0xc6) == 0x40 || (op & 0xe6) == 0xa2)
+	{
+		Z80Registers regs;
+		z80getRegisters(regs);
+		return regs.bc & 0xff;
+	}
+
+	return -1;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Output.
+//
+//-------------------------------------------------------------------------
+
+static void showInstruction(uint16_t addr, char *text)
+{
+	uint8_t bytes[4];
+	for (int i = 0; i < 4; ++i)
+		bytes[i] = readRam(addr + i);
+
+	int length = disassemble(bytes, addr, text);
+
+	fprintf(console, "%04X  ", addr);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (i < length)
+			fprintf(console, "%02X ", bytes[i]);
+		else
+			fprintf(console, "   ");
+	}
+	fprintf(console, " %s\n", text);
+
+	listAddr = addr + length;
+}
+
+static void showRegisters()
+{
+	Z80Registers r;
+	z80getRegisters(r);
+
+	static const char flagNames[] = "SZ5H3PNC";
+	char flags[9];
+	for (int i = 0; i < 8; ++i)
+		flags[i] = (r.af & (0x80 >> i)) ? flagNames[i] : '-';
+	flags[8] = 0;
+
+	fprintf(console,
+		"AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SP=%04X PC=%04X  %s\n"
+		"AF'=%04X BC'=%04X DE'=%04X HL'=%04X IR=%04X IFF=%X  T=%llu\n",
+		r.af, r.bc, r.de, r.hl, r.ix, r.iy, r.sp, r.pc, flags,
+		r.afAlt, r.bcAlt, r.deAlt, r.hlAlt, r.ir, r.iff,
+		(unsigned long long) z80cycles());
+
+	int index = symbolIndex(r.pc);
+	if (index >= 0)
+		fprintf(console, "%s+%X\n", symbolName(index).c_str(), r.pc - symbolAddress(index));
+
+	char text[DisasmTextSize];
+	showInstruction(r.pc, text);
+}
+
+static void dumpMemory(uint16_t addr, int length)
+{
+	for (int line = 0; line < length; line += 16)
+	{
+		fprintf(console, "%04X ", (uint16_t) (addr + line));
+
+		for (int i = 0; i < 16; ++i)
+			fprintf(console, " %02X", readRam(addr + line + i));
+
+		fprintf(console, "  ");
+		for (int i = 0; i < 16; ++i)
+		{
+			uint8_t ch = readRam(addr + line + i) & 0x7f;
+			fputc((ch >= 0x20 && ch < 0x7f) ? ch : '.', console);
+		}
+		fputc('\n', console);
+	}
+}
+
+static void listBreakpoints()
+{
+	for (int addr = 0; addr < 64*1024; ++addr)
+		if (testBit(breakMap, addr))
+			fprintf(console, "break %04X\n", addr);
+
+	for (int port = 0; port < 256; ++port)
+		if (testBit(portMap, port))
+			fprintf(console, "port  %02X\n", port);
+
+	for (const Watch &w : watches)
+		fprintf(console, "watch %04X-%04X %s%s\n", w.first, w.last,
+			(w.kind & WatchRead) ? "r" : "", (w.kind & WatchWrite) ? "w" : "");
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Commands.
+//
+//-------------------------------------------------------------------------
+
+static void addWatch(const vector<string> &args)
+{
+	Watch w = { 0, 0, WatchRead | WatchWrite };
+	size_t next = 2;
+
+	if (args.size() < 2 || !parseAddress(args[1], w.first))
+	{
+		fprintf(console, "w addr [last] [r|w|rw]\n");
+		return;
+	}
+
+	w.last = w.first;
+	if (next < args.size() && parseAddress(args[next], w.last))
+		++next;
+
+	if (next < args.size())
+	{
+		const string &kind = args[next];
+		w.kind = 0;
+		if (kind.find('r') != string::npos)
+			w.kind |= WatchRead;
+		if (kind.find('w') != string::npos)
+			w.kind |= WatchWrite;
+	}
+
+	if (w.last < w.first || w.kind == 0)
+	{
+		fprintf(console, "w addr [last] [r|w|rw]\n");
+		return;
+	}
+
+	watches.push_back(w);
+
+	if (w.kind & WatchRead)
+		hookReads(watchRead, w.first, w.last);
+	if (w.kind & WatchWrite)
+		hookWrites(watchWrite, w.first, w.last);
+}
+
+static void deleteBreakpoints()
+{
+	memset(breakMap, 0, sizeof(breakMap));
+	memset(portMap, 0, sizeof(portMap));
+	armed = false;
+
+	watches.clear();
+	hookReads(nullptr);
+	hookWrites(nullptr);
+}
+
+// Returns once the emulation should carry on
+
+static void commandLoop()
+{
+	stopRequested = false;
+	showRegisters();
+
+	while (1)
+	{
+		fprintf(console, "> ");
+		fflush(console);
+
+		char line[256];
+		if (!fgets(line, sizeof(line), commands))
+			exit(0);			// The console went away
+
+		istringstream words(line);
+		vector<string> args;
+		string tok;
+		while (words >> tok)
+			args.push_back(tok);
+
+		if (args.empty())
+			continue;
+
+		const string &cmd = args[0];
+		uint16_t addr;
+
+		if (cmd == "c")
+		{
+			return;
+		}
+		else if (cmd == "s")
+		{
+			stepsLeft = (args.size() > 1) ? strtoull(args[1].c_str(), nullptr, 0) : 1;
+			if (stepsLeft == 0)
+				stepsLeft = 1;
+			return;
+		}
+		else if (cmd == "r")
+		{
+			showRegisters();
+		}
+		else if (cmd == "m" && args.size() > 1 && parseAddress(args[1], addr))
+		{
+			int length = (args.size() > 2) ? strtol(args[2].c_str(), nullptr, 16) : 0x40;
+			dumpMemory(addr, length);
+		}
+		else if (cmd == "u")
+		{
+			if (args.size() > 1 && parseAddress(args[1], addr))
+				listAddr = addr;
+
+			int count = (args.size() > 2) ? atoi(args[2].c_str()) : 16;
+			char text[DisasmTextSize];
+
+			for (int i = 0; i < count; ++i)
+				showInstruction(listAddr, text);
+		}
+		else if (cmd == "b" && args.size() > 1 && parseAddress(args[1], addr))
+		{
+			setBit(breakMap, addr);
+			armed = true;
+		}
+		else if (cmd == "p" && args.size() > 1)
+		{
+			setBit(portMap, strtoul(args[1].c_str(), nullptr, 16) & 0xff);
+			armed = true;
+		}
+		else if (cmd == "w")
+		{
+			addWatch(args);
+		}
+		else if (cmd == "l")
+		{
+			listBreakpoints();
+		}
+		else if (cmd == "d")
+		{
+			deleteBreakpoints();
+		}
+		else if (cmd == "y")
+		{
+			syncRamFile(true);
+		}
+		else if (cmd == "q")
+		{
+			exit(0);
+		}
+		else
+		{
+			fprintf(console, "c, s [n], r, m addr [len], u [addr] [n], b addr,\n"
+				"w addr [last] [r|w|rw], p port, l, d, y, q\n");
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run one instruction, stopping first if it's at a breakpoint or the user
+// asked to stop, and afterwards if it touched a watched address.
+//
+//-------------------------------------------------------------------------
+
+void debugStep()
+{
+	uint16_t pc = z80pc();
+
+	if (armed && !stopRequested)
+	{
+		if (testBit(breakMap, pc))
+		{
+			fprintf(console, "Breakpoint\n");
+			stopRequested = true;
+		}
+		else
+		{
+			int port = ioPort(pc);
+			if (port >= 0 && testBit(portMap, port))
+			{
+				fprintf(console, "Port %02X\n", port);
+				stopRequested = true;
+			}
+		}
+	}
+
+	if (stopRequested)
+		commandLoop();
+
+	running = true;
+	z80step();
+	running = false;
+
+	if (!watchHit.empty())
+	{
+		fprintf(console, "Watchpoint, %s\n", watchHit.c_str());
+		watchHit.clear();
+		stopRequested = true;
+	}
+
+	if (stepsLeft > 0 && --stepsLeft == 0)
+		stopRequested = true;
+
+	// Typing anything at the console breaks in, but don't ask too often
+
+	if ((++pollCount & 0xffff) == 0)
+	{
+		int n = 0;
+		ioctl(fileno(commands), FIONREAD, &n);
+
+		if (n > 0)
+		{
+			char discard[256];
+			fgets(discard, sizeof(discard), commands);
+			stopRequested = true;
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Open the console.
+//
+//-------------------------------------------------------------------------
+
+void startDebugger(const string &filename)
+{
+	int fd = open(filename.c_str(), O_RDWR);
+	if (fd < 0 || !(commands = fdopen(fd, "r")) || !(console = fdopen(dup(fd), "w")))
+	{
+		fprintf(stderr, "Cannot open debugger console %s\n", filename.c_str());
+		exit(1);
+	}
+
+	setvbuf(console, nullptr, _IOLBF, 0);
+	listAddr = z80pc();
+}
@@ -0,0 +1,21 @@
+//-------------------------------------------------------------------------
+//
+// Interactive debugger, see debugger.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <string>
+
+// Open the debugger console (another terminal, or a fifo) and stop at the
+// first instruction waiting for commands
+
+void startDebugger(const std::string &console);
+
+// Drop-in replacement for z80step() which checks the breakpoints
+
+void debugStep();
+
+#endif
@@ -0,0 +1,567 @@
+//-------------------------------------------------------------------------
+//
+// Table driven Z80 disassembler, used by nasdis, nastrace, the profiler
+// report and the debugger.
+//
+// Every prefix page (main, CB, ED, DD, FD, DDCB, FDCB) has a 256 entry
+// table giving the mnemonic, the operands and the length of each opcode.
+// The tables are built at compile time from the usual x/y/z breakdown of
+// the opcode byte, so there's no hand typed table to get wrong and nothing
+// to set up at run time. Formatting is done by hand rather than printf so
+// that whole traces can be decoded quickly.
+//
+// DD or FD in front of an instruction that doesn't use HL is ignored by
+// the Z80, so it comes out as a one byte DB and the next instruction is
+// disassembled on its own. Unused ED opcodes are two byte DBs.
+//
+//-------------------------------------------------------------------------
+
+#include <array>
+
+#include "disasm.h"
+#include "symbols.h"
+
+using namespace std;
+
+
+enum Mnemonic : uint8_t
+{
+	DB, NOP, LD, INC, DEC, EX, EXX, ADD, ADC, SUB, SBC, AND, XOR, OR, CP,
+	RLCA, RRCA, RLA, RRA, DAA, CPL, SCF, CCF, HALT, DI, EI,
+	DJNZ, JR, JP, CALL, RET, RETN, RETI, RST, PUSH, POP, IN, OUT,
+	RLC, RRC, RL, RR, SLA, SRA, SLL, SRL, BIT, RES, SET,
+	NEG, IM, RRD, RLD,
+	LDI, CPI, INI, OUTI, LDD, CPD, IND, OUTD,
+	LDIR, CPIR, INIR, OTIR, LDDR, CPDR, INDR, OTDR,
+};
+
+static const char *const mnemonics[] =
+{
+	"DB", "NOP", "LD", "INC", "DEC", "EX", "EXX", "ADD", "ADC", "SUB", "SBC", "AND", "XOR", "OR", "CP",
+	"RLCA", "RRCA", "RLA", "RRA", "DAA", "CPL", "SCF", "CCF", "HALT", "DI", "EI",
+	"DJNZ", "JR", "JP", "CALL", "RET", "RETN", "RETI", "RST", "PUSH", "POP", "IN", "OUT",
+	"RLC", "RRC", "RL", "RR", "SLA", "SRA", "SLL", "SRL", "BIT", "RES", "SET",
+	"NEG", "IM", "RRD", "RLD",
+	"LDI", "CPI", "INI", "OUTI", "LDD", "CPD", "IND", "OUTD",
+	"LDIR", "CPIR", "INIR", "OTIR", "LDDR", "CPDR", "INDR", "OTDR",
+};
+
+enum Operand : uint8_t
+{
+	None,
+
+	// In the order of the r field of an opcode
+
+	B, C, D, E, H, L, AtHL, A,
+
+	IXH, IXL, IYH, IYL, AtIX, AtIY, JumpIX, JumpIY,
+
+	BC, DE, HL, SP, AF, AFAlt, IX, IY,
+	AtBC, AtDE, AtSP, AtC, I, R,
+
+	CondNZ, CondZ, CondNC, CondC, CondPO, CondPE, CondP, CondM,
+
+	Imm8,			// n, the last byte of the instruction
+	Imm16,			// nn, the last two bytes
+	Address,		// nn, as the target of a JP or CALL
+	AtAddress,		// (nn)
+	AtPort,			// (n)
+	Relative,		// e, shown as the target address
+	Number,			// A bit number or IM mode
+	Restart,		// An RST address
+	Byte0,			// Raw bytes, for DB
+	Byte1,
+};
+
+static const char *const operands[] =
+{
+	"",
+	"B", "C", "D", "E", "H", "L", "(HL)", "A",
+	"IXH", "IXL", "IYH", "IYL", "(IX", "(IY", "(IX)", "(IY)",
+	"BC", "DE", "HL", "SP", "AF", "AF'", "IX", "IY",
+	"(BC)", "(DE)", "(SP)", "(C)", "I", "R",
+	"NZ", "Z", "NC", "C", "PO", "PE", "P", "M",
+};
+
+struct Entry
+{
+	Mnemonic	mnemonic;
+	Operand		op1, op2;
+	uint8_t		number;		// For Number and Restart
+	uint8_t		length;		// Including any prefix
+};
+
+// Which register takes the place of HL
+
+enum Index { UseHL, UseIX, UseIY };
+
+
+//-------------------------------------------------------------------------
+//
+// Table builders. These run in the compiler.
+//
+//-------------------------------------------------------------------------
+
+constexpr Entry entry(Mnemonic m, Operand op1 = None, Operand op2 = None, int length = 1, int number = 0)
+{
+	return Entry { m, op1, op2, uint8_t(number), uint8_t(length) };
+}
+
+constexpr bool isIndirect(Operand op)
+{
+	return op == AtHL || op == AtIX || op == AtIY;
+}
+
+// Size of the immediate data an operand takes
+
+constexpr int dataSize(Operand op)
+{
+	switch (op)
+	{
+	case Imm8: case AtPort: case Relative:
+		return 1;
+	case Imm16: case Address: case AtAddress:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+// Swap HL for IX or IY. When (HL) becomes (IX+d) the other operand keeps
+// using plain H and L, as on the real chip.
+
+constexpr Operand indexed(Operand op, Index index, bool memory)
+{
+	if (index == UseHL)
+		return op;
+
+	switch (op)
+	{
+	case H:		return memory ? H : (index == UseIX ? IXH : IYH);
+	case L:		return memory ? L : (index == UseIX ? IXL : IYL);
+	case AtHL:	return index == UseIX ? AtIX : AtIY;
+	case HL:	return index == UseIX ? IX : IY;
+	default:	return op;
+	}
+}
+
+constexpr bool usesHL(Operand op)
+{
+	return op == H || op == L || op == AtHL || op == HL;
+}
+
+// Apply the prefix to an unprefixed entry and work out the length
+
+constexpr Entry finish(Entry e, Index index)
+{
+	int length = 1 + dataSize(e.op1) + dataSize(e.op2);
+
+	if (index != UseHL)
+	{
+		// EX DE,HL and EXX are the only instructions that name HL but
+		// ignore the prefix
+
+		bool affected = (usesHL(e.op1) || usesHL(e.op2)) && e.mnemonic != EX && e.mnemonic != EXX;
+		if (e.mnemonic == EX && e.op1 == AtSP)
+			affected = true;
+
+		if (!affected)
+			return entry(DB, Byte0);
+
+		bool memory = isIndirect(e.op1) || isIndirect(e.op2);
+
+		e.op1 = indexed(e.op1, index, memory);
+		e.op2 = indexed(e.op2, index, memory);
+		length += memory ? 2 : 1;
+	}
+
+	e.length = length;
+	return e;
+}
+
+constexpr Operand reg(int r)		{ return Operand(B + r); }
+constexpr Operand cond(int cc)		{ return Operand(CondNZ + cc); }
+constexpr Operand regPair(int p)	{ return p == 3 ? SP : Operand(BC + p); }
+constexpr Operand stackPair(int p)	{ return p == 3 ? AF : Operand(BC + p); }
+
+constexpr Entry alu(int y, Operand src)
+{
+	const Mnemonic ops[8] = { ADD, ADC, SUB, SBC, AND, XOR, OR, CP };
+
+	// ADD, ADC and SBC name the accumulator, the others don't
+
+	if (y == 0 || y == 1 || y == 3)
+		return entry(ops[y], A, src);
+	return entry(ops[y], src);
+}
+
+constexpr Entry decodeMain(int op)
+{
+	int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+
+	switch (x)
+	{
+	case 0:
+		switch (z)
+		{
+		case 0:
+			switch (y)
+			{
+			case 0:  return entry(NOP);
+			case 1:  return entry(EX, AF, AFAlt);
+			case 2:  return entry(DJNZ, Relative);
+			case 3:  return entry(JR, Relative);
+			default: return entry(JR, cond(y - 4), Relative);
+			}
+
+		case 1:
+			return q == 0 ? entry(LD, regPair(p), Imm16) : entry(ADD, HL, regPair(p));
+
+		case 2:
+		{
+			const Operand mem[4] = { AtBC, AtDE, AtAddress, AtAddress };
+			Operand r = (p == 2) ? HL : A;
+			return q == 0 ? entry(LD, mem[p], r) : entry(LD, r, mem[p]);
+		}
+
+		case 3:  return entry(q == 0 ? INC : DEC, regPair(p));
+		case 4:  return entry(INC, reg(y));
+		case 5:  return entry(DEC, reg(y));
+		case 6:  return entry(LD, reg(y), Imm8);
+
+		default:
+		{
+			const Mnemonic ops[8] = { RLCA, RRCA, RLA, RRA, DAA, CPL, SCF, CCF };
+			return entry(ops[y]);
+		}
+		}
+
+	case 1:
+		if (y == 6 && z == 6)
+			return entry(HALT);
+		return entry(LD, reg(y), reg(z));
+
+	case 2:
+		return alu(y, reg(z));
+
+	default:
+		switch (z)
+		{
+		case 0:  return entry(RET, cond(y));
+
+		case 1:
+			if (q == 0)
+				return entry(POP, stackPair(p));
+			switch (p)
+			{
+			case 0:  return entry(RET);
+			case 1:  return entry(EXX);
+			case 2:  return entry(JP, AtHL);
+			default: return entry(LD, SP, HL);
+			}
+
+		case 2:  return entry(JP, cond(y), Address);
+
+		case 3:
+			switch (y)
+			{
+			case 0:  return entry(JP, Address);
+			case 1:  return entry(DB, Byte0);		// CB, never looked up
+			case 2:  return entry(OUT, AtPort, A);
+			case 3:  return entry(IN, A, AtPort);
+			case 4:  return entry(EX, AtSP, HL);
+			case 5:  return entry(EX, DE, HL);
+			case 6:  return entry(DI);
+			default: return entry(EI);
+			}
+
+		case 4:  return entry(CALL, cond(y), Address);
+
+		case 5:
+			if (q == 0)
+				return entry(PUSH, stackPair(p));
+			if (p == 0)
+				return entry(CALL, Address);
+			return entry(DB, Byte0);				// Another prefix
+
+		case 6:  return alu(y, Imm8);
+		default: return entry(RST, Restart, None, 1, y * 8);
+		}
+	}
+}
+
+constexpr array<Entry, 256> buildMain(Index index)
+{
+	array<Entry, 256> table {};
+
+	for (int op = 0; op < 256; ++op)
+	{
+		Entry e = decodeMain(op);
+
+		// JP (HL) has no displacement even with an index register
+
+		if (op == 0xe9 && index != UseHL)
+			e = entry(JP, index == UseIX ? JumpIX : JumpIY, None, 2);
+		else if (e.mnemonic == DB)
+			e.length = 1;
+		else
+			e = finish(e, index);
+
+		table[op] = e;
+	}
+
+	return table;
+}
+
+// CB page. With an index register the instruction is DD CB d op and always
+// works on (IX+d), any other register in the opcode also gets the result.
+
+constexpr array<Entry, 256> buildCB(Index index)
+{
+	const Mnemonic rotates[8] = { RLC, RRC, RL, RR, SLA, SRA, SLL, SRL };
+
+	array<Entry, 256> table {};
+
+	for (int op = 0; op < 256; ++op)
+	{
+		int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+
+		Operand target = reg(z);
+		Operand copy = None;
+		int length = 2;
+
+		if (index != UseHL)
+		{
+			target = (index == UseIX) ? AtIX : AtIY;
+			if (z != 6 && x != 1)
+				copy = reg(z);
+			length = 4;
+		}
+
+		// RES and SET have no room for the copy register, it's
+		// undocumented anyway
+
+		if (x == 0)
+			table[op] = entry(rotates[y], target, copy, length);
+		else
+			table[op] = Entry { Mnemonic(BIT + x - 1), Number, target, uint8_t(y), uint8_t(length) };
+	}
+
+	return table;
+}
+
+constexpr array<Entry, 256> buildED()
+{
+	array<Entry, 256> table {};
+
+	for (int op = 0; op < 256; ++op)
+	{
+		int x = op >> 6, y = (op >> 3) & 7, z = op & 7, p = y >> 1, q = y & 1;
+
+		Entry e = entry(DB, Byte0, Byte1, 2);
+
+		if (x == 1)
+		{
+			switch (z)
+			{
+			case 0:  e = (y == 6) ? entry(IN, AtC, None, 2) : entry(IN, reg(y), AtC, 2); break;
+			case 1:  e = entry(OUT, AtC, y == 6 ? Number : reg(y), 2); break;
+			case 2:  e = entry(q == 0 ? SBC : ADC, HL, regPair(p), 2); break;
+			case 3:  e = q == 0 ? entry(LD, AtAddress, regPair(p), 4) : entry(LD, regPair(p), AtAddress, 4); break;
+			case 4:  e = entry(NEG, None, None, 2); break;
+			case 5:  e = entry(y == 1 ? RETI : RETN, None, None, 2); break;
+
+			case 6:
+			{
+				const int modes[4] = { 0, 0, 1, 2 };
+				e = entry(IM, Number, None, 2, modes[y & 3]);
+				break;
+			}
+
+			default:
+			{
+				const Entry ops[8] =
+				{
+					entry(LD, I, A, 2), entry(LD, R, A, 2), entry(LD, A, I, 2), entry(LD, A, R, 2),
+					entry(RRD, None, None, 2), entry(RLD, None, None, 2),
+					entry(DB, Byte0, Byte1, 2), entry(DB, Byte0, Byte1, 2),
+				};
+				e = ops[y];
+			}
+			}
+		}
+		else if (x == 2 && z <= 3 && y >= 4)
+		{
+			e = entry(Mnemonic(LDI + (y - 4) * 4 + z), None, None, 2);
+		}
+
+		table[op] = e;
+	}
+
+	return table;
+}
+
+static constexpr array<Entry, 256> mainTable = buildMain(UseHL);
+static constexpr array<Entry, 256> ixTable   = buildMain(UseIX);
+static constexpr array<Entry, 256> iyTable   = buildMain(UseIY);
+static constexpr array<Entry, 256> cbTable   = buildCB(UseHL);
+static constexpr array<Entry, 256> ixcbTable = buildCB(UseIX);
+static constexpr array<Entry, 256> iycbTable = buildCB(UseIY);
+static constexpr array<Entry, 256> edTable   = buildED();
+
+static_assert(mainTable[0x21].length == 3 && ixTable[0x36].length == 4, "LD HL,nn / LD (IX+d),n");
+static_assert(ixTable[0x66].op1 == H && ixTable[0x26].op1 == IXH, "LD H,(IX+d) / LD IXH,n");
+static_assert(edTable[0xb0].mnemonic == LDIR && ixcbTable[0x46].op2 == AtIX, "LDIR / BIT 0,(IX+d)");
+
+
+//-------------------------------------------------------------------------
+//
+// Find the table entry for the instruction at bytes.
+//
+//-------------------------------------------------------------------------
+
+static const Entry &lookup(const uint8_t *bytes)
+{
+	switch (bytes[0])
+	{
+	case 0xcb:	return cbTable[bytes[1]];
+	case 0xed:	return edTable[bytes[1]];
+	case 0xdd:	return bytes[1] == 0xcb ? ixcbTable[bytes[3]] : ixTable[bytes[1]];
+	case 0xfd:	return bytes[1] == 0xcb ? iycbTable[bytes[3]] : iyTable[bytes[1]];
+	default:	return mainTable[bytes[0]];
+	}
+}
+
+int instructionLength(const uint8_t *bytes)
+{
+	return lookup(bytes).length;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Text output.
+//
+//-------------------------------------------------------------------------
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+static char *putString(char *out, const char *s)
+{
+	while (*s)
+		*out++ = *s++;
+	return out;
+}
+
+static char *putHex8(char *out, uint8_t val)
+{
+	*out++ = hexDigits[val >> 4];
+	*out++ = hexDigits[val & 15];
+	return out;
+}
+
+static char *putHex16(char *out, uint16_t val)
+{
+	return putHex8(putHex8(out, val >> 8), val & 0xff);
+}
+
+// An address, by name if there's a symbol right there
+
+static char *putAddress(char *out, uint16_t addr)
+{
+	int index = symbolIndex(addr);
+
+	if (index >= 0 && symbolAddress(index) == addr)
+	{
+		const string &name = symbolName(index);
+
+		size_t n = name.size() < DisasmTextSize - 20 ? name.size() : DisasmTextSize - 20;
+		for (size_t i = 0; i < n; ++i)
+			*out++ = name[i];
+
+		return out;
+	}
+
+	return putHex16(out, addr);
+}
+
+static char *putOperand(char *out, Operand op, const Entry &e, const uint8_t *bytes, uint16_t pc)
+{
+	const uint8_t *data = bytes + e.length;		// Immediate data is at the end
+
+	switch (op)
+	{
+	case AtIX: case AtIY:
+	{
+		int8_t d = bytes[2];
+
+		out = putString(out, operands[op]);
+		*out++ = d < 0 ? '-' : '+';
+		out = putHex8(out, d < 0 ? -d : d);
+		*out++ = ')';
+		return out;
+	}
+
+	case Imm8:
+		return putHex8(out, data[-1]);
+
+	case Imm16:
+		return putHex16(out, data[-2] | (data[-1] << 8));
+
+	case Address:
+		return putAddress(out, data[-2] | (data[-1] << 8));
+
+	case AtAddress:
+		*out++ = '(';
+		out = putAddress(out, data[-2] | (data[-1] << 8));
+		*out++ = ')';
+		return out;
+
+	case AtPort:
+		*out++ = '(';
+		out = putHex8(out, bytes[1]);
+		*out++ = ')';
+		return out;
+
+	case Relative:
+		return putAddress(out, pc + e.length + int8_t(data[-1]));
+
+	case Number:
+		*out++ = '0' + e.number;
+		return out;
+
+	case Restart:
+		return putHex8(out, e.number);
+
+	case Byte0:
+		return putHex8(out, bytes[0]);
+
+	case Byte1:
+		return putHex8(out, bytes[1]);
+
+	default:
+		return putString(out, operands[op]);
+	}
+}
+
+int disassemble(const uint8_t *bytes, uint16_t pc, char *text)
+{
+	const Entry &e = lookup(bytes);
+
+	char *out = putString(text, mnemonics[e.mnemonic]);
+
+	if (e.op1 != None)
+	{
+		*out++ = ' ';
+		out = putOperand(out, e.op1, e, bytes, pc);
+
+		if (e.op2 != None)
+		{
+			*out++ = ',';
+			out = putOperand(out, e.op2, e, bytes, pc);
+		}
+	}
+
+	*out = 0;
+	return e.length;
+}
@@ -0,0 +1,28 @@
+//-------------------------------------------------------------------------
+//
+// Z80 disassembler, see disasm.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdint.h>
+
+// Enough room for the longest instruction text, e.g. "LD (IX+7F),FF"
+// or a symbol name in place of an address
+
+const int DisasmTextSize = 48;
+
+// Disassemble the instruction in bytes, which must hold at least four
+// bytes, as if it were at address pc. The text is written to text and the
+// instruction length in bytes is returned. Addresses that have a symbol
+// are shown by name.
+
+int disassemble(const uint8_t *bytes, uint16_t pc, char *text);
+
+// Just the length of the instruction in bytes
+
+int instructionLength(const uint8_t *bytes);
+
+#endif
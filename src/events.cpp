@@ -0,0 +1,115 @@
+//-------------------------------------------------------------------------
+//
+// Events keyed on the emulated T-state count. A device that needs
+// something to happen later (a key to come up, a byte to arrive) schedules
+// a call for then, and the run loop steps the processor straight up to the
+// next one rather than asking every device after every instruction. Being
+// tied to the emulated clock, the same run always sees its events at the
+// same instructions however fast the host is.
+//
+// The events are kept in a binary min-heap on their time. The sequence
+// number keeps events due at the same time in the order they came.
+//
+//-------------------------------------------------------------------------
+
+#include <algorithm>
+#include <vector>
+
+#include "events.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+struct Event
+{
+	uint64_t		when;
+	uint64_t		sequence;
+	EventHandler	handler;
+};
+
+// The heap functions build a max-heap, so the comparison is turned round
+
+static bool later(const Event &a, const Event &b)
+{
+	return a.when != b.when ? a.when > b.when : a.sequence > b.sequence;
+}
+
+struct EventQueue
+{
+	vector<Event>	heap;
+	uint64_t		sequence = 0;
+};
+
+static EventQueue mainQueue;
+static machine_local EventQueue *queue = &mainQueue;
+
+
+//-------------------------------------------------------------------------
+//
+// Add and remove events.
+//
+//-------------------------------------------------------------------------
+
+void scheduleEvent(uint64_t when, EventHandler handler)
+{
+	queue->heap.push_back({ when, queue->sequence++, handler });
+	push_heap(queue->heap.begin(), queue->heap.end(), later);
+}
+
+void cancelEvents(EventHandler handler)
+{
+	vector<Event> &heap = queue->heap;
+
+	heap.erase(remove_if(heap.begin(), heap.end(),
+		[handler](const Event &e) { return e.handler == handler; }), heap.end());
+	make_heap(heap.begin(), heap.end(), later);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run them.
+//
+//-------------------------------------------------------------------------
+
+uint64_t nextEvent()
+{
+	return queue->heap.empty() ? UINT64_MAX : queue->heap.front().when;
+}
+
+void runEvents()
+{
+	vector<Event> &heap = queue->heap;
+
+	while (!heap.empty() && heap.front().when <= z80cycles())
+	{
+		pop_heap(heap.begin(), heap.end(), later);
+		EventHandler handler = heap.back().handler;
+		heap.pop_back();
+
+		handler();
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// More than one machine.
+//
+//-------------------------------------------------------------------------
+
+EventQueue *newEventQueue()
+{
+	return new EventQueue;
+}
+
+void deleteEventQueue(EventQueue *q)
+{
+	delete q;
+}
+
+void useEventQueue(EventQueue *q)
+{
+	queue = q ? q : &mainQueue;
+}
@@ -0,0 +1,43 @@
+//-------------------------------------------------------------------------
+//
+// Things the devices want to happen at a set point in emulated time, see
+// events.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+typedef void (*EventHandler)();
+
+// Call handler once the T-state count (z80cycles()) reaches when. Events
+// due at the same time run in the order they were scheduled.
+
+void scheduleEvent(uint64_t when, EventHandler handler);
+
+// Forget any calls to handler that haven't happened yet
+
+void cancelEvents(EventHandler handler);
+
+// When the next event is due, UINT64_MAX if there isn't one. The run loop
+// steps the processor until then and calls runEvents().
+
+uint64_t nextEvent();
+
+// Call the handlers of everything that's due, including anything they
+// schedule that's already due
+
+void runEvents();
+
+// Each machine in the server has its own events, switched in before it
+// runs. Null goes back to the built-in ones.
+
+struct EventQueue;
+
+EventQueue *newEventQueue();
+void deleteEventQueue(EventQueue *q);
+void useEventQueue(EventQueue *q);
+
+#endif
@@ -0,0 +1,185 @@
+//-------------------------------------------------------------------------
+//
+// A device for moving whole files between the host and the NASCOM's
+// memory, rather than typing them in or going through the tape. A program
+// puts a request block in memory:
+//
+//   +0  command, 1 to load a file and 2 to save one
+//   +1  address (word)
+//   +3  length (word), 0 for everything up to the top of memory. For a
+//       load it's the most to read. It's replaced by how many bytes moved.
+//   +5  file name, ending with a zero
+//
+// then writes the block's address to port F0, low byte first, and anything
+// to port F1. The file goes straight into or out of memory before the OUT
+// finishes, and reading port F1 says how it went (see Status).
+//
+// The files all live in the one directory given on the command line, and
+// a name can't go outside it.
+//
+// hostfile.nal has a routine at DF00 for calling it from BASIC, with the
+// block's address as the argument and the status as the result:
+//
+//   DF00  21 08 DF     LD   HL,DF08
+//   DF03  E5           PUSH HL
+//   DF04  2A 0B E0     LD   HL,(E00B)   ; DEINT, argument to DE
+//   DF07  E9           JP   (HL)
+//   DF08  7B           LD   A,E
+//   DF09  D3 F0        OUT  (F0),A
+//   DF0B  7A           LD   A,D
+//   DF0C  D3 F0        OUT  (F0),A
+//   DF0E  D3 F1        OUT  (F1),A
+//   DF10  DB F1        IN   A,(F1)
+//   DF12  47           LD   B,A
+//   DF13  AF           XOR  A
+//   DF14  2A 0D E0     LD   HL,(E00D)   ; ABPASS, AB back to BASIC
+//   DF17  E9           JP   (HL)
+//
+// Answer "Memory size?" with 57088 to keep BASIC out of DF00 upwards, and
+// then for example, to load LOGO.TXT onto the screen:
+//
+//   10 DOKE 4100,-8448:B=-8320:N$="LOGO.TXT"
+//   20 POKE B,1:DOKE B+1,2058:DOKE B+3,0
+//   30 FOR I=1 TO LEN(N$)
+//   35 POKE B+4+I,ASC(MID$(N$,I,1)):NEXT
+//   40 POKE B+5+LEN(N$),0:PRINT USR(B),DEEK(B+3)
+//
+//-------------------------------------------------------------------------
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+
+#include "hostfile.h"
+#include "memory.h"
+#include "ports.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+enum Command { Load = 1, Save = 2 };
+
+enum Status
+{
+	Done		= 0,
+	BadName		= 1,	// Missing, too long or outside the directory
+	NoFile		= 2,	// Couldn't be opened or created
+	Failed		= 3,	// Couldn't write it all
+	BadCommand	= 4,
+};
+
+const int MaxName = 64;
+
+struct HostFiles
+{
+	string		dir;
+	uint16_t	block = 0;		// Address of the request block
+	bool		highNext = false;	// The next byte to port F0 is the high one
+	uint8_t		status = Done;
+};
+
+static HostFiles host;
+
+
+//-------------------------------------------------------------------------
+//
+// Carry out a request.
+//
+//-------------------------------------------------------------------------
+
+static uint16_t readWord(uint16_t addr)
+{
+	return readRam(addr) | (readRam(addr + 1) << 8);
+}
+
+static void writeWord(uint16_t addr, uint16_t value)
+{
+	writeRam(addr, value & 0xff);
+	writeRam(addr + 1, value >> 8);
+}
+
+static bool readName(uint16_t addr, string &name)
+{
+	name.clear();
+
+	for (int i = 0; i < MaxName; ++i)
+	{
+		char ch = readRam(addr + i);
+		if (ch == 0)
+			return !name.empty() && name[0] != '.' && name.find('/') == string::npos;
+
+		name += ch;
+	}
+
+	return false;
+}
+
+static Status transfer(uint16_t block)
+{
+	uint8_t command = readRam(block);
+	uint16_t addr = readWord(block + 1);
+	unsigned length = readWord(block + 3);
+	string name;
+
+	if (command != Load && command != Save)
+		return BadCommand;
+
+	if (!readName(block + 5, name))
+		return BadName;
+
+	unsigned room = 0x10000 - addr;
+	if (length == 0 || length > room)
+		length = room;
+
+	string path = host.dir + "/" + name;
+	int fd = command == Load ? open(path.c_str(), O_RDONLY)
+							 : open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NoFile;
+
+	unsigned moved = command == Load ? readFileIntoRam(fd, addr, length)
+									 : writeRamToFile(fd, addr, length);
+	close(fd);
+
+	writeWord(block + 3, moved);
+
+	return command == Save && moved < length ? Failed : Done;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The ports.
+//
+//-------------------------------------------------------------------------
+
+static void blockOut(uint8_t port, uint8_t value)
+{
+	if (host.highNext)
+		host.block = (host.block & 0xff) | (value << 8);
+	else
+		host.block = (host.block & 0xff00) | value;
+
+	host.highNext = !host.highNext;
+}
+
+static void goOut(uint8_t port, uint8_t value)
+{
+	host.status = transfer(host.block);
+	host.highNext = false;
+}
+
+static uint8_t statusIn(uint8_t port)
+{
+	return host.status;
+}
+
+void startHostFiles(const string &dir)
+{
+	host.dir = dir;
+
+	attachDevice(0xf0, 0xf0, { nullptr, blockOut });
+	attachDevice(0xf1, 0xf1, { statusIn, goOut });
+}
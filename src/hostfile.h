@@ -0,0 +1,17 @@
+//-------------------------------------------------------------------------
+//
+// Loading and saving host files from the NASCOM, see hostfile.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef HOSTFILE_H
+#define HOSTFILE_H
+
+#include <string>
+
+// Put the host file device on ports F0 and F1, with the files it can get
+// at in dir
+
+void startHostFiles(const std::string &dir);
+
+#endif
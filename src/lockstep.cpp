@@ -0,0 +1,635 @@
+//-------------------------------------------------------------------------
+//
+// Experimental lockstep engine. Up to LockstepLanes machines that are
+// running the same program keep their registers side by side, one array
+// per register with a lane for each machine. Each instruction is run for
+// every lane sharing a PC at once, with plain loops over the lanes that
+// the compiler turns into SIMD. On x86-64 with GCC the hot functions are
+// built for AVX-512, AVX2 and plain SSE2 and the best one is picked when
+// the program starts.
+//
+// Each round, the lanes at the lowest PC run. If there are several, the
+// instruction bytes match in all of them (remembered for each PC until
+// memory could have changed) and it's one of the register
+// instructions below, it runs for all of them at once. Anything else
+// (memory, the stack, I/O, prefixes, a lane on its own) goes through
+// z80step() one lane at a time. Lanes that branch differently drop apart
+// and come back together when their PCs meet again.
+//
+// Done in lanes: NOP, LD r,r', LD r,n, the 8-bit ALU on registers and
+// immediates, INC/DEC r, LD rr,nn, INC/DEC rr, ADD HL,rr, the rotates of
+// A, CPL, SCF, CCF, EX DE,HL, JP, JP cc, JR, JR cc and DJNZ. The flags and
+// T-states are worked out exactly as z80step() does.
+//
+//-------------------------------------------------------------------------
+
+#include "lockstep.h"
+#include "memory.h"
+
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__)
+#define VECTOR_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+#else
+#define VECTOR_CLONES
+#endif
+
+#define LANES for (int i = 0; i < LockstepLanes; ++i)
+
+// The registers the lanes work on, the rest only matter to z80step()
+
+static uint16_t AF[LockstepLanes];
+static uint16_t BC[LockstepLanes];
+static uint16_t DE[LockstepLanes];
+static uint16_t HL[LockstepLanes];
+static uint16_t SP[LockstepLanes];
+static uint16_t PC[LockstepLanes];
+
+static Z80Registers rest[LockstepLanes];
+static uint64_t cycles[LockstepLanes];
+static uint64_t endCycles[LockstepLanes];
+static uint8_t *memory[LockstepLanes];
+static bool loaded[LockstepLanes];
+
+static int inCore = -1;				// Lane whose memory z80step() is using
+
+// Instructions whose bytes have been seen to match in all the lanes. Only
+// z80step() writes memory while the lanes run, so everything here is good
+// until it next runs. The caller may change memory between runs.
+
+struct Checked
+{
+	uint32_t	generation;
+	uint16_t	pc;
+	uint16_t	lanes;			// Which lanes were compared
+};
+
+static Checked checked[256];
+static uint32_t generation = 1;
+
+static LockstepStats stats;
+
+
+//-------------------------------------------------------------------------
+//
+// Lane helpers. The masks are all ones for the lanes taking part.
+//
+//-------------------------------------------------------------------------
+
+static inline uint16_t blend(uint16_t old, uint16_t val, uint16_t mask)
+{
+	return (old & ~mask) | (val & mask);
+}
+
+static inline uint16_t parity(uint16_t val)
+{
+	val ^= val >> 4;
+	val ^= val >> 2;
+	val ^= val >> 1;
+	return (~val & 1) << 2;
+}
+
+// The 8-bit registers by their number in the opcode, 6 is (HL) and isn't
+// handled here
+
+static inline uint16_t *regPair(int r)
+{
+	switch (r >> 1)
+	{
+	case 0:		return BC;
+	case 1:		return DE;
+	case 2:		return HL;
+	default:	return AF;
+	}
+}
+
+static inline void getReg(int r, uint16_t *val)
+{
+	const uint16_t *pair = regPair(r);
+
+	if (r == 7 || !(r & 1))
+		LANES val[i] = pair[i] >> 8;
+	else
+		LANES val[i] = pair[i] & 0xff;
+}
+
+static inline void setReg(int r, const uint16_t *val, const uint16_t *m)
+{
+	uint16_t *pair = regPair(r);
+
+	if (r == 7 || !(r & 1))
+		LANES pair[i] = blend(pair[i], (pair[i] & 0xff) | (val[i] << 8), m[i]);
+	else
+		LANES pair[i] = blend(pair[i], (pair[i] & 0xff00) | (val[i] & 0xff), m[i]);
+}
+
+static inline uint16_t *widePair(int p)
+{
+	switch (p)
+	{
+	case 0:		return BC;
+	case 1:		return DE;
+	case 2:		return HL;
+	default:	return SP;
+	}
+}
+
+// Condition codes NZ, Z, NC, C, PO, PE, P, M
+
+static inline void condition(int cc, const uint16_t *m, uint16_t *taken)
+{
+	static const uint16_t flags[4] = { 0x40, 0x01, 0x04, 0x80 };
+	uint16_t flag = flags[cc >> 1];
+	uint16_t want = (cc & 1) ? flag : 0;
+
+	LANES taken[i] = ((AF[i] & flag) == want) ? m[i] : 0;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The 8-bit arithmetic, the same sums as z80step()
+//
+//-------------------------------------------------------------------------
+
+static inline void alu(int y, const uint16_t *val, const uint16_t *m)
+{
+	uint16_t af[LockstepLanes];
+
+	switch (y)
+	{
+	case 0:		// ADD
+	case 1:		// ADC
+	case 2:		// SUB
+	case 3:		// SBC
+		LANES
+		{
+			uint16_t acu = AF[i] >> 8;
+			uint16_t carry = (y & 1) ? (AF[i] & 1) : 0;
+			uint16_t sum = (y & 2) ? acu - val[i] - carry : acu + val[i] + carry;
+			uint16_t cbits = acu ^ val[i] ^ sum;
+
+			af[i] = ((sum & 0xff) << 8) | (sum & 0xa8) |
+				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
+				(((cbits >> 6) ^ (cbits >> 5)) & 4) | (y & 2) |
+				((cbits >> 8) & 1);
+		}
+		break;
+
+	case 4:		// AND
+	case 5:		// XOR
+	case 6:		// OR
+		LANES
+		{
+			uint16_t acu = AF[i] >> 8;
+			uint16_t sum = (y == 4) ? (acu & val[i]) : (y == 5) ? (acu ^ val[i]) : (acu | val[i]);
+
+			af[i] = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) |
+				((y == 4) ? 0x10 : 0) | parity(sum);
+		}
+		break;
+
+	default:	// CP, the undocumented bits come from the operand
+		LANES
+		{
+			uint16_t acu = AF[i] >> 8;
+			uint16_t sum = acu - val[i];
+			uint16_t cbits = acu ^ val[i] ^ sum;
+
+			af[i] = (AF[i] & ~0xff) | (sum & 0x80) |
+				(((sum & 0xff) == 0) << 6) | (val[i] & 0x28) |
+				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
+				(cbits & 0x10) | ((cbits >> 8) & 1);
+		}
+		break;
+	}
+
+	LANES AF[i] = blend(AF[i], af[i], m[i]);
+}
+
+static inline void incDec(int r, bool dec, const uint16_t *m)
+{
+	uint16_t val[LockstepLanes];
+
+	getReg(r, val);
+	LANES val[i] = (val[i] + (dec ? 0xff : 1)) & 0xff;
+	setReg(r, val, m);
+
+	LANES
+	{
+		uint16_t temp = val[i];
+		uint16_t af = (AF[i] & ~0xfe) | (temp & 0xa8) | ((temp == 0) << 6);
+
+		if (dec)
+			af |= (((temp & 0xf) == 0xf) << 4) | ((temp == 0x7f) << 2) | 2;
+		else
+			af |= (((temp & 0xf) == 0) << 4) | ((temp == 0x80) << 2);
+
+		AF[i] = blend(AF[i], af, m[i]);
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// How long each instruction that can run in lanes is, or 0 if it can't.
+//
+//-------------------------------------------------------------------------
+
+static int laneLength(uint8_t op)
+{
+	int y = (op >> 3) & 7;
+	int z = op & 7;
+
+	if (op >= 0x40 && op < 0x80)
+		return (op == 0x76 || y == 6 || z == 6) ? 0 : 1;
+	if (op >= 0x80 && op < 0xc0)
+		return (z == 6) ? 0 : 1;
+
+	if ((op & 0xc7) == 0xc6)					// ALU A,n
+		return 2;
+	if ((op & 0xc7) == 0x06)					// LD r,n
+		return (y == 6) ? 0 : 2;
+	if ((op & 0xc6) == 0x04)					// INC r and DEC r
+		return (y == 6) ? 0 : 1;
+	if ((op & 0xcf) == 0x01)					// LD rr,nn
+		return 3;
+	if ((op & 0xc7) == 0x03 || (op & 0xcf) == 0x09)	// INC rr, DEC rr, ADD HL,rr
+		return 1;
+	if ((op & 0xc7) == 0xc2 || op == 0xc3)		// JP
+		return 3;
+	if (op == 0x10 || op == 0x18 || (op & 0xe7) == 0x20)	// DJNZ and JR
+		return 2;
+
+	switch (op)
+	{
+	case 0x00: case 0x07: case 0x0f: case 0x17: case 0x1f:
+	case 0x2f: case 0x37: case 0x3f: case 0xeb:
+		return 1;
+	}
+
+	return 0;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run one instruction in the lanes selected by m. They all have the same
+// PC, which next is the address after.
+//
+//-------------------------------------------------------------------------
+
+VECTOR_CLONES
+static void execute(const uint8_t *bytes, uint16_t next, const uint16_t *m)
+{
+	uint8_t op = bytes[0];
+	uint8_t n = bytes[1];
+	uint16_t nn = bytes[1] | (bytes[2] << 8);
+	int y = (op >> 3) & 7;
+	int z = op & 7;
+
+	uint16_t val[LockstepLanes];
+	uint16_t taken[LockstepLanes];			// Lanes that branch
+	uint16_t target = next;
+	uint16_t tstates = 4;
+	uint16_t extra = 0;						// When the branch is taken
+
+	LANES taken[i] = 0;
+
+	if (op >= 0x40 && op < 0x80)			// LD r,r'
+	{
+		getReg(z, val);
+		setReg(y, val, m);
+	}
+	else if (op >= 0x80 && op < 0xc0)		// ALU A,r
+	{
+		getReg(z, val);
+		alu(y, val, m);
+	}
+	else if ((op & 0xc7) == 0xc6)			// ALU A,n
+	{
+		LANES val[i] = n;
+		alu(y, val, m);
+		tstates = 7;
+	}
+	else if ((op & 0xc7) == 0x06)			// LD r,n
+	{
+		LANES val[i] = n;
+		setReg(y, val, m);
+		tstates = 7;
+	}
+	else if ((op & 0xc6) == 0x04)			// INC r, DEC r
+	{
+		incDec(y, op & 1, m);
+	}
+	else if ((op & 0xcf) == 0x01)			// LD rr,nn
+	{
+		uint16_t *pair = widePair(op >> 4);
+		LANES pair[i] = blend(pair[i], nn, m[i]);
+		tstates = 10;
+	}
+	else if ((op & 0xc7) == 0x03)			// INC rr, DEC rr
+	{
+		uint16_t *pair = widePair((op >> 4) & 3);
+		uint16_t step = (op & 8) ? 0xffff : 1;
+		LANES pair[i] = blend(pair[i], pair[i] + step, m[i]);
+		tstates = 6;
+	}
+	else if ((op & 0xcf) == 0x09)			// ADD HL,rr
+	{
+		const uint16_t *pair = widePair(op >> 4);
+		LANES
+		{
+			uint32_t sum = HL[i] + pair[i];
+			uint32_t cbits = (HL[i] ^ pair[i] ^ sum) >> 8;
+			uint16_t af = (AF[i] & ~0x3b) | ((sum >> 8) & 0x28) |
+				(cbits & 0x10) | ((cbits >> 8) & 1);
+
+			HL[i] = blend(HL[i], sum, m[i]);
+			AF[i] = blend(AF[i], af, m[i]);
+		}
+		tstates = 11;
+	}
+	else if (op == 0xc3 || (op & 0xc7) == 0xc2)	// JP, JP cc
+	{
+		if (op == 0xc3)
+			LANES taken[i] = m[i];
+		else
+			condition(y, m, taken);
+		target = nn;
+		tstates = 10;
+	}
+	else if (op == 0x18 || (op & 0xe7) == 0x20)	// JR, JR cc
+	{
+		if (op == 0x18)
+		{
+			LANES taken[i] = m[i];
+			tstates = 12;
+		}
+		else
+		{
+			condition(y - 4, m, taken);
+			tstates = 7;
+			extra = 5;
+		}
+		target = next + (int8_t) n;
+	}
+	else if (op == 0x10)					// DJNZ
+	{
+		LANES
+		{
+			uint16_t bc = BC[i] - 0x100;
+			BC[i] = blend(BC[i], bc, m[i]);
+			taken[i] = (bc & 0xff00) ? m[i] : 0;
+		}
+		target = next + (int8_t) n;
+		tstates = 8;
+		extra = 5;
+	}
+	else
+	{
+		switch (op)
+		{
+		case 0x07:			// RLCA
+			LANES AF[i] = blend(AF[i], ((AF[i] >> 7) & 0x0128) | ((AF[i] << 1) & ~0x1ff) |
+				(AF[i] & 0xc4) | ((AF[i] >> 15) & 1), m[i]);
+			break;
+		case 0x0f:			// RRCA
+			LANES
+			{
+				uint16_t temp = AF[i] >> 8;
+				uint16_t sum = temp >> 1;
+				AF[i] = blend(AF[i], ((temp & 1) << 15) | (sum << 8) |
+					(sum & 0x28) | (AF[i] & 0xc4) | (temp & 1), m[i]);
+			}
+			break;
+		case 0x17:			// RLA
+			LANES AF[i] = blend(AF[i], ((AF[i] << 8) & 0x0100) | ((AF[i] >> 7) & 0x28) |
+				((AF[i] << 1) & ~0x01ff) | (AF[i] & 0xc4) | ((AF[i] >> 15) & 1), m[i]);
+			break;
+		case 0x1f:			// RRA
+			LANES
+			{
+				uint16_t temp = AF[i] >> 8;
+				uint16_t sum = temp >> 1;
+				AF[i] = blend(AF[i], ((AF[i] & 1) << 15) | (sum << 8) |
+					(sum & 0x28) | (AF[i] & 0xc4) | (temp & 1), m[i]);
+			}
+			break;
+		case 0x2f:			// CPL
+			LANES AF[i] = blend(AF[i], (~AF[i] & ~0xff) | (AF[i] & 0xc5) |
+				((~AF[i] >> 8) & 0x28) | 0x12, m[i]);
+			break;
+		case 0x37:			// SCF
+			LANES AF[i] = blend(AF[i], (AF[i] & ~0x3b) | ((AF[i] >> 8) & 0x28) | 1, m[i]);
+			break;
+		case 0x3f:			// CCF
+			LANES AF[i] = blend(AF[i], (AF[i] & ~0x3b) | ((AF[i] >> 8) & 0x28) |
+				((AF[i] & 1) << 4) | (~AF[i] & 1), m[i]);
+			break;
+		case 0xeb:			// EX DE,HL
+			LANES
+			{
+				uint16_t temp = HL[i];
+				HL[i] = blend(HL[i], DE[i], m[i]);
+				DE[i] = blend(DE[i], temp, m[i]);
+			}
+			break;
+		}
+	}
+
+	LANES
+	{
+		PC[i] = blend(PC[i], taken[i] ? target : next, m[i]);
+		cycles[i] += m[i] ? tstates + (taken[i] ? extra : 0) : 0;
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Pick the lanes to run next: the ones still going at the lowest PC.
+// Returns how many there are.
+//
+//-------------------------------------------------------------------------
+
+VECTOR_CLONES
+static int selectLanes(int stopAt, uint16_t *m)
+{
+	uint16_t live[LockstepLanes];
+	uint32_t lowest = 0x10000;
+	int count = 0;
+
+	LANES live[i] = (loaded[i] && cycles[i] < endCycles[i] && PC[i] != stopAt) ? 0xffff : 0;
+	LANES lowest = (live[i] && PC[i] < lowest) ? PC[i] : lowest;
+	LANES
+	{
+		m[i] = (live[i] && PC[i] == lowest) ? 0xffff : 0;
+		count += m[i] & 1;
+	}
+
+	return count;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run a lane on its own through the normal core.
+//
+//-------------------------------------------------------------------------
+
+static void scalarStep(int lane)
+{
+	Z80Registers &r = rest[lane];
+
+	r.af = AF[lane];
+	r.bc = BC[lane];
+	r.de = DE[lane];
+	r.hl = HL[lane];
+	r.sp = SP[lane];
+	r.pc = PC[lane];
+
+	if (inCore != lane)
+	{
+		useMemory(memory[lane]);
+		inCore = lane;
+	}
+
+	z80setRegisters(r);
+	z80setCycles(cycles[lane]);
+	z80step();
+	z80getRegisters(r);
+	cycles[lane] = z80cycles();
+
+	AF[lane] = r.af;
+	BC[lane] = r.bc;
+	DE[lane] = r.de;
+	HL[lane] = r.hl;
+	SP[lane] = r.sp;
+	PC[lane] = r.pc;
+
+	++stats.scalarSteps;
+	++generation;
+}
+
+// Run the selected lanes together if they can be, returns false if not
+
+static bool vectorStep(int count, const uint16_t *m)
+{
+	int first = 0;
+	while (!m[first])
+		++first;
+
+	// A lane at a HALT or with an interrupt to take needs z80step()
+
+	for (int lane = first; lane < LockstepLanes; ++lane)
+		if (m[lane] && rest[lane].pending)
+			return false;
+
+	uint16_t pc = PC[first];
+	uint8_t bytes[3] = { readMemory(memory[first], pc), 0, 0 };
+	int length = laneLength(bytes[0]);
+
+	if (length == 0)
+		return false;
+
+	for (int k = 1; k < length; ++k)
+		bytes[k] = readMemory(memory[first], pc + k);
+
+	// The program has to be the same in all of them
+
+	uint16_t lanes = 0;
+	for (int lane = 0; lane < LockstepLanes; ++lane)
+		lanes |= (m[lane] & 1) << lane;
+
+	Checked &check = checked[pc & 0xff];
+
+	if (check.generation != generation || check.pc != pc || (check.lanes & lanes) != lanes)
+	{
+		for (int lane = first + 1; lane < LockstepLanes; ++lane)
+		{
+			if (!m[lane])
+				continue;
+
+			for (int k = 0; k < length; ++k)
+				if (readMemory(memory[lane], pc + k) != bytes[k])
+					return false;
+		}
+
+		check = { generation, pc, lanes };
+	}
+
+	execute(bytes, pc + length, m);
+
+	++stats.vectorSteps;
+	stats.vectorLanes += count;
+	return true;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The interface.
+//
+//-------------------------------------------------------------------------
+
+void lockstepLoad(int lane, const Z80Registers &regs, uint64_t count, uint8_t *storage)
+{
+	rest[lane] = regs;
+	AF[lane] = regs.af;
+	BC[lane] = regs.bc;
+	DE[lane] = regs.de;
+	HL[lane] = regs.hl;
+	SP[lane] = regs.sp;
+	PC[lane] = regs.pc;
+
+	cycles[lane] = count;
+	memory[lane] = storage;
+	loaded[lane] = true;
+
+	if (inCore == lane)
+		inCore = -1;
+}
+
+void lockstepRun(uint64_t count, int stopAt)
+{
+	LANES endCycles[i] = cycles[i] + count;
+	++generation;
+
+	uint16_t m[LockstepLanes];
+	int selected;
+
+	while ((selected = selectLanes(stopAt, m)) > 0)
+	{
+		if (selected > 1 && vectorStep(selected, m))
+			continue;
+
+		for (int lane = 0; lane < LockstepLanes; ++lane)
+			if (m[lane])
+				scalarStep(lane);
+	}
+}
+
+void lockstepSave(int lane, Z80Registers &regs, uint64_t &count)
+{
+	regs = rest[lane];
+	regs.af = AF[lane];
+	regs.bc = BC[lane];
+	regs.de = DE[lane];
+	regs.hl = HL[lane];
+	regs.sp = SP[lane];
+	regs.pc = PC[lane];
+
+	count = cycles[lane];
+}
+
+void lockstepClear()
+{
+	LANES loaded[i] = false;
+	inCore = -1;
+	++generation;
+	stats = LockstepStats();
+}
+
+LockstepStats lockstepStats()
+{
+	return stats;
+}
@@ -0,0 +1,46 @@
+//-------------------------------------------------------------------------
+//
+// Experimental lockstep engine for running a group of machines that share
+// a program, see lockstep.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+
+#include "z80-simulator.h"
+
+const int LockstepLanes = 16;
+
+// Put a machine in a lane. Its memory comes from newMemory() and stays
+// owned by the caller.
+
+void lockstepLoad(int lane, const Z80Registers &regs, uint64_t cycles, uint8_t *memory);
+
+// Run every loaded lane for count T-states, or until it reaches stopAt
+// (-1 for no stop address)
+
+void lockstepRun(uint64_t count, int stopAt = -1);
+
+// Get a lane's machine back
+
+void lockstepSave(int lane, Z80Registers &regs, uint64_t &cycles);
+
+// Empty all the lanes
+
+void lockstepClear();
+
+// How the instructions were run, across all the lanes
+
+struct LockstepStats
+{
+	uint64_t	vectorSteps;		// Instructions run for several lanes at once
+	uint64_t	vectorLanes;		// The lane-instructions they covered
+	uint64_t	scalarSteps;		// Lane-instructions that went through z80step()
+};
+
+LockstepStats lockstepStats();
+
+#endif
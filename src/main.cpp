@@ -1,13 +1,22 @@
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <unistd.h>
 
-using namespace std;
-
+#include "cassette.h"
+#include "debugger.h"
+#include "events.h"
+#include "hostfile.h"
+#include "memory.h"
+#include "ports.h"
+#include "profiler.h"
+#include "script.h"
+#include "symbols.h"
+#include "trace.h"
+#include "view.h"
+#include "z80-simulator.h"
 
-extern void loadNasFile(const string &filename);
-extern void setUnbufferedInput();
-extern void pollKeyboard();
-extern void z80step();
+using namespace std;
 
 
 //-------------------------------------------------------------------------
@@ -33,11 +42,200 @@ static void clearScreen()
 
 void instructionDelay()
 {
-	for (int i = 0; i < 2000; ++i)	// Tune this value with an argv ??
+	for (volatile int i = 0; i < 2000; ++i)	// Tune this value with an argv ??
 		;
 }
 
 
+//-------------------------------------------------------------------------
+//
+// Things done once a frame, 50 times a second of emulated time at 4MHz.
+//
+//-------------------------------------------------------------------------
+
+const uint64_t FrameCycles = 80000;
+
+static View *view = nullptr;		// Shared with any viewers, see view.cpp
+
+static void frameEvent()
+{
+	syncRamFile(false);
+
+	if (view)
+		publishView(view);
+
+	scheduleEvent(z80cycles() + FrameCycles, frameEvent);
+}
+
+
+static void closeViewAtExit()
+{
+	closeView(view);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The emulation loop. It's instantiated once for each kind of step so that
+// optional tooling doesn't cost anything when it's not being used. The
+// processor runs straight up to the next event, the keyboard included
+// (see events.h), and nothing else is looked at in between.
+//
+//-------------------------------------------------------------------------
+
+template<void Step()>
+static void run()
+{
+	while (1)
+	{
+		uint64_t next = nextEvent();
+
+		while (z80cycles() < next)
+		{
+			instructionDelay();
+			Step();
+		}
+
+		runEvents();
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Headless runs go flat out until one of the limits is reached, and the
+// reason becomes the exit code. Nothing is drawn, but the screen can still
+// be watched for some text. Only the lines that have changed are checked.
+//
+//-------------------------------------------------------------------------
+
+enum StopReason
+{
+	StopScriptDone   = 0,	// The script ran to the end
+	StopAddress      = 2,	// PC reached the address
+	StopText         = 3,	// The text appeared on the screen
+	StopHalt         = 4,	// A HALT instruction was executed
+	StopCycles       = 5,	// Out of T-states
+	StopInstructions = 6,	// Out of instructions
+	StopScriptFailed = 7,	// The screen didn't show what the script expected
+};
+
+struct Limits
+{
+	uint64_t	cycles = 0;			// Zero for no limit
+	uint64_t	instructions = 0;
+	int			address = -1;		// -1 for none
+	string		text;
+	bool		script = false;		// Is a script driving the run?
+};
+
+static Limits limits;
+
+template<void Step()>
+static StopReason runHeadless()
+{
+	uint64_t instructions = 0;
+
+	while (1)
+	{
+		runEvents();
+		uint64_t next = nextEvent();
+
+		while (z80cycles() < next)
+		{
+			uint16_t pc = z80pc();
+			if (pc == limits.address)
+				return StopAddress;
+
+			Step();
+			++instructions;
+
+			// Only true when a HALT ran, not when an interrupt got in first
+
+			if (z80halted())
+				return StopHalt;
+			if (limits.cycles && z80cycles() >= limits.cycles)
+				return StopCycles;
+			if (limits.instructions && instructions >= limits.instructions)
+				return StopInstructions;
+
+			uint16_t lines = takeDirtyLines();
+
+			if (lines && !limits.text.empty() && findOnScreen(limits.text, lines))
+				return StopText;
+
+			if (limits.script)
+			{
+				ScriptStatus status = scriptPoll(lines);
+
+				if (status == ScriptDone)
+					return StopScriptDone;
+				if (status == ScriptFailed)
+					return StopScriptFailed;
+			}
+		}
+	}
+}
+
+template<void Step()>
+static void start(bool headless)
+{
+	pollKeyboard();
+	frameEvent();
+
+	if (!headless)
+		run<Step>();
+
+	StopReason reason = runHeadless<Step>();
+
+	cout << screenText();
+	exit(reason);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Command line help.
+//
+//-------------------------------------------------------------------------
+
+static void usage()
+{
+	cerr << "Usage: nascom [-p profile] [-f folded] [-s symbols]... [-t trace [-n records]]\n"
+		 << "              [-g console] [-b [-c cycles] [-i count] [-a addr] [-e text]]\n"
+		 << "              [-x script] [-r tape] [-w tape] [-u] [-d dir] [-m file]\n"
+		 << "              [-v name]\n"
+		 << "  -p file   profile the run, the report is written to file on exit\n"
+		 << "            (or whenever SIGUSR1 is received)\n"
+		 << "  -f file   also write the profiled call stacks for a flame graph\n"
+		 << "  -s file   load a label/address symbol map, can be repeated\n"
+		 << "  -t file   trace into a ring buffer, dumped to file on exit, on a\n"
+		 << "            crash or whenever SIGUSR2 is received (see nastrace)\n"
+		 << "  -n count  number of records in the trace ring (default 1M)\n"
+		 << "  -g tty    debug from another terminal (or a fifo), stopping at\n"
+		 << "            the first instruction\n"
+		 << "  -b        headless batch run, the final screen is printed as text\n"
+		 << "            and the exit code says which of these stopped it:\n"
+		 << "  -a addr   2  PC reaches addr (hex or a symbol)\n"
+		 << "  -e text   3  text appears on the screen\n"
+		 << "            4  a HALT instruction is executed\n"
+		 << "  -c count  5  count T-states have run\n"
+		 << "  -i count  6  count instructions have run\n"
+		 << "  -x file   run an expect script headless and flat out (see\n"
+		 << "            script.cpp), exit code 0 when it finishes or\n"
+		 << "            7 if it times out waiting for the screen\n"
+		 << "  -r file   the .cas tape image NAS-SYS R reads\n"
+		 << "  -w file   the .cas tape image NAS-SYS W writes\n"
+		 << "  -u        turbo tape, the UART is always ready\n"
+		 << "  -d dir    let programs load and save the files in dir (see\n"
+		 << "            hostfile.cpp), with a helper for BASIC at DF00\n"
+		 << "  -m file   keep the RAM in file, so it's still there next time\n"
+		 << "  -v name   publish the screen and registers every frame in the\n"
+		 << "            shared memory /name, for nasview and the like\n";
+	exit(1);
+}
+
+
 //-------------------------------------------------------------------------
 //
 // Let's go!
@@ -46,22 +244,173 @@ void instructionDelay()
 
 extern "C" unsigned int simz80(unsigned int PC, int count, void (*fnc)()); //??
 
-int main()
+int main(int argc, char *argv[])
 {
+	string profileFile;
+	string foldedFile;
+	string traceFile;
+	string debugConsole;
+	string tapeIn, tapeOut;
+	bool turbo = false;
+	string hostDir;
+	string ramFile;
+	string viewName;
+	size_t traceRecords = 1024*1024;
+	bool headless = false;
+	string address;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "p:f:s:t:n:g:bc:i:a:e:x:r:w:ud:m:v:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p':
+			profileFile = optarg;
+			break;
+
+		case 'f':
+			foldedFile = optarg;
+			break;
+
+		case 's':
+			loadSymbols(optarg);
+			break;
+
+		case 't':
+			traceFile = optarg;
+			break;
+
+		case 'n':
+			traceRecords = strtoul(optarg, nullptr, 0);
+			break;
+
+		case 'g':
+			debugConsole = optarg;
+			break;
+
+		case 'b':
+			headless = true;
+			break;
+
+		case 'c':
+			limits.cycles = strtoull(optarg, nullptr, 0);
+			break;
+
+		case 'i':
+			limits.instructions = strtoull(optarg, nullptr, 0);
+			break;
+
+		case 'a':
+			address = optarg;		// Wait until all the symbols are loaded
+			break;
+
+		case 'e':
+			limits.text = optarg;
+			break;
+
+		case 'x':
+			loadScript(optarg);
+			limits.script = true;
+			headless = true;
+			break;
+
+		case 'r':
+			tapeIn = optarg;
+			break;
+
+		case 'w':
+			tapeOut = optarg;
+			break;
+
+		case 'u':
+			turbo = true;
+			break;
+
+		case 'd':
+			hostDir = optarg;
+			break;
+
+		case 'm':
+			ramFile = optarg;
+			break;
+
+		case 'v':
+			viewName = optarg;
+			break;
+
+		default:
+			usage();
+		}
+	}
+
+	if (!profileFile.empty() + !traceFile.empty() + !debugConsole.empty() > 1)
+	{
+		cerr << "Only one of profiling, tracing and debugging at a time" << endl;
+		exit(1);
+	}
+
+	if (!address.empty())
+	{
+		uint16_t addr;
+		if (!parseAddress(address, addr))
+		{
+			cerr << "Unknown address " << address << endl;
+			exit(1);
+		}
+
+		limits.address = addr;
+	}
+
+	if (!headless && (limits.cycles || limits.instructions || limits.address >= 0 || !limits.text.empty()))
+		usage();
+
 	loadNasFile("nassys3.nal");
 	loadNasFile("nastest.nal");
 	loadNasFile("basic.nal");
 
-	clearScreen();
-	setUnbufferedInput();
+	if (!ramFile.empty())
+		mapRamFile(ramFile);
+
+	startCassette(tapeIn, tapeOut, turbo);
+
+	if (!hostDir.empty())
+	{
+		loadNasFile("hostfile.nal");
+		startHostFiles(hostDir);
+	}
+
+	if (!viewName.empty())
+	{
+		view = openView("/" + viewName);
+		atexit(closeViewAtExit);
+	}
+
+	if (headless)
+		setHeadless();
+	else
+	{
+		clearScreen();
+		setUnbufferedInput();
+	}
 
   //simz80(0, 1, pollKeyboard);
 
-	while (1)
+	if (!profileFile.empty())
+	{
+		startProfiler(profileFile, foldedFile);
+		start<profileStep>(headless);
+	}
+	else if (!traceFile.empty())
+	{
+		startTrace(traceFile, traceRecords);
+		start<traceStep>(headless);
+	}
+	else if (!debugConsole.empty())
 	{
-		//instructionDelay();
-		pollKeyboard();
-		z80step();
+		startDebugger(debugConsole);
+		start<debugStep>(headless);
 	}
+	else
+		start<z80step>(headless);
 }
 
@@ -1,12 +1,58 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "z80-simulator.h"
 
 using namespace std;
 
 
-// The Z80 can address 64K of memory.
+// The Z80 can address 64K of memory. The server gives each machine its own
+// and switches between them, see useMemory().
+
+static uint8_t mainRam[64*1024] = {'\0'};
+static machine_local uint8_t *ram = mainRam;
+
+// Writes are dispatched on 1K pages, so each region only pays for the
+// special handling it needs. The real handlers are kept separately so that
+// a hook can be slotted in front of them.
+//
+// Reads go straight to the storage for the page, unless the page has been
+// hooked in which case its pointer is null.
+
+const int PageShift = 10;
+const int PageMask  = (1 << PageShift) - 1;
+const int NumPages  = 64;
+
+static WriteHandler pageWriters[NumPages];
+static WriteHandler realWriters[NumPages];
+static WriteHandler writeHook = nullptr;
+
+static machine_local uint8_t *pageReaders[NumPages];
+static ReadHook readHook = nullptr;
+
+// The file the RAM is mapped from, if there is one
+
+static uint8_t *mappedRam = nullptr;
 
-/*static*/ uint8_t ram[64*1024] = {'\0'};
+// Once shareRoms() has been called, every machine reads the ROM pages from
+// this one read-only copy
+
+static uint8_t *sharedRoms = nullptr;
+
+// The screen is 16 lines of 48 characters, with the lines 64 bytes apart.
+// Writes to each line are noted, so that anything watching the screen only
+// has to look at what changed.
+
+const uint16_t VideoStart = 0x80a;
+
+static machine_local uint16_t dirtyLines = 0;
 
 
 //-------------------------------------------------------------------------
@@ -32,7 +78,7 @@ inline uint8_t printable(uint8_t ch) { return max(ch & 0x7f, 0x20); }
 
 static void updateScreen()
 {
-  uint8_t * const screen = &ram[0x80a];	// Start of video memory
+  uint8_t * const screen = &ram[VideoStart];	// Start of video memory
 
 	cout << "[H";		// Cursor home to top left
 
@@ -62,14 +108,36 @@ static void updateScreen()
 
 //-------------------------------------------------------------------------
 //
-// All 64K of ram is readable, so nothing exciting here.
+// All 64K of ram is readable, so nothing exciting here unless someone is
+// watching.
 //
 //-------------------------------------------------------------------------
 
+static inline bool isRom(int page);
+
+// Where a page's bytes really live
+
+static inline uint8_t *pageStorage(int page)
+{
+  uint8_t *storage = (sharedRoms && isRom(page)) ? sharedRoms : ram;
+  return &storage[page << PageShift];
+}
+
+static uint8_t readHooked(uint16_t addr)
+{
+  readHook(addr);
+  return pageStorage(addr >> PageShift)[addr & PageMask];
+}
+
 extern "C"  //??
 uint8_t readRam(uint16_t addr)
 {
-  return ram[addr];
+  uint8_t *page = pageReaders[addr >> PageShift];
+
+  if (page)
+    return page[addr & PageMask];
+
+  return readHooked(addr);
 }
 
 
@@ -79,18 +147,542 @@ uint8_t readRam(uint16_t addr)
 //
 //-------------------------------------------------------------------------
 
+// Don't overwrite read-only ROM locations
+
+static void writeRom(uint16_t addr, uint8_t val)
+{
+}
+
+static void writePlain(uint16_t addr, uint8_t val)
+{
+  ram[addr] = val;
+}
+
+// Video memory, the screen needs to be redrawn. Writes to the margins
+// don't show so they don't count as changes.
+
+static inline void markDirty(uint16_t addr)
+{
+  unsigned offset = addr - VideoStart;
+
+  if (offset < 16*64 && (offset & 63) < 48)
+    dirtyLines |= 1 << (offset >> 6);
+}
+
+static void writeVideo(uint16_t addr, uint8_t val)
+{
+  ram[addr] = val;
+  markDirty(addr);
+  updateScreen();
+}
+
+// Without a terminal there's nothing to redraw
+
+static void writeVideoHeadless(uint16_t addr, uint8_t val)
+{
+  ram[addr] = val;
+  markDirty(addr);
+}
+
+// Tell the hook and then carry on as normal
+
+static void writeHooked(uint16_t addr, uint8_t val)
+{
+  writeHook(addr, val);
+  realWriters[addr >> PageShift](addr, val);
+}
+
+static struct MemoryMap
+{
+  MemoryMap()
+  {
+    for (int page = 0; page < NumPages; ++page)
+    {
+      uint16_t addr = page << PageShift;
+
+      if ((addr < 0x800) || (addr >= 0xe000))
+        realWriters[page] = writeRom;
+      else if (addr < 0xc00)
+        realWriters[page] = writeVideo;
+      else
+        realWriters[page] = writePlain;
+
+      pageWriters[page] = realWriters[page];
+      pageReaders[page] = &ram[addr];
+    }
+  }
+} memoryMap;
+
+
+static inline bool isRom(int page)
+{
+  return realWriters[page] == writeRom;
+}
+
+
 extern "C"  //??
 void writeRam(uint16_t addr, uint8_t val)
 {
-  // Don't overwrite read-only ROM locations
+  pageWriters[addr >> PageShift](addr, val);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The block instructions, see z80-simulator.h. Only memory that reads and
+// writes plainly is done here, video included, so a copy over a hooked
+// page or onto ROM is turned down and goes a byte at a time. The screen is
+// redrawn once at the end rather than for every byte.
+//
+//-------------------------------------------------------------------------
+
+// The bytes from addr to the edge of its page, going in the direction of
+// step
+
+static inline unsigned pageLeft(uint16_t addr, int step)
+{
+  return step > 0 ? (1 << PageShift) - (addr & PageMask) : (addr & PageMask) + 1;
+}
+
+// Do all the pages covering count bytes from addr pass test
+
+template<typename Test>
+static bool allPages(uint16_t addr, unsigned count, int step, Test test)
+{
+  while (count)
+  {
+    if (!test(addr >> PageShift))
+      return false;
+
+    unsigned len = min(count, pageLeft(addr, step));
+    addr += step * (int) len;
+    count -= len;
+  }
+
+  return true;
+}
+
+static inline bool isVideo(int page)
+{
+  return realWriters[page] == writeVideo || realWriters[page] == writeVideoHeadless;
+}
+
+// Can a page be written to in place, without anyone having to know
+
+static inline bool plainlyWritable(int page)
+{
+  return pageWriters[page] == realWriters[page] &&
+         (realWriters[page] == writePlain || isVideo(page));
+}
+
+extern "C"
+int copyRam(uint16_t from, uint16_t to, unsigned count, int step)
+{
+  auto readable = [](int page) { return pageReaders[page] != nullptr; };
+
+  if (!allPages(from, count, step, readable) || !allPages(to, count, step, plainlyWritable))
+    return -1;
+
+  // Copying onto bytes that are still to be read repeats the ones before
+  // them, so the copy can't go further than that distance at a time
+
+  unsigned gap = (uint16_t) (step > 0 ? to - from : from - to);
+  bool redraw = false;
+
+  while (count)
+  {
+    unsigned len = min({count, pageLeft(from, step), pageLeft(to, step)});
+    if (gap > 0 && gap < count)
+      len = min(len, gap);
+
+    uint16_t source = step > 0 ? from : from - len + 1;
+    uint16_t dest = step > 0 ? to : to - len + 1;
+
+    memmove(&ram[dest], &pageReaders[source >> PageShift][source & PageMask], len);
+
+    if (isVideo(dest >> PageShift))
+    {
+      for (unsigned i = 0; i < len; ++i)
+        markDirty(dest + i);
+      redraw |= realWriters[dest >> PageShift] == writeVideo;
+    }
+
+    from += step * (int) len;
+    to += step * (int) len;
+    count -= len;
+  }
+
+  if (redraw)
+    updateScreen();
+
+  return ram[(uint16_t) (to - step)];
+}
+
+extern "C"
+unsigned findRam(uint16_t from, unsigned count, uint8_t val, int step)
+{
+  if (!allPages(from, count, step, [](int page) { return pageReaders[page] != nullptr; }))
+    return 0;
 
-  if ((addr >= 0x800) && (addr < 0xe000))
-	  ram[addr] = val;
+  unsigned looked = 0;
+
+  while (looked < count)
+  {
+    unsigned len = min(count - looked, pageLeft(from, step));
+    const uint8_t *start = &pageReaders[from >> PageShift][from & PageMask];
+
+    if (step > 0)
+    {
+      if (const void *hit = memchr(start, val, len))
+        return looked + (static_cast<const uint8_t *>(hit) - start) + 1;
+    }
+    else
+    {
+      if (const void *hit = memrchr(start - len + 1, val, len))
+        return looked + (start - static_cast<const uint8_t *>(hit)) + 1;
+    }
 
-  // Did we write to the screen?
+    from += step * (int) len;
+    looked += len;
+  }
 
-	if ((addr >= 0x800) && (addr <= 0x800+1024))
-		updateScreen();
+  return count;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Moving files in and out of memory for the host file device. Plain pages
+// are read into and written from where they are, anything else goes a
+// byte at a time through the handlers, so ROM stays as it is and the
+// hooks see every byte.
+//
+//-------------------------------------------------------------------------
+
+unsigned readFileIntoRam(int fd, uint16_t addr, unsigned count)
+{
+  unsigned done = 0;
+  bool redraw = false;
+
+  while (done < count)
+  {
+    int page = addr >> PageShift;
+    unsigned len = min(count - done, pageLeft(addr, 1));
+    ssize_t got;
+
+    if (plainlyWritable(page))
+    {
+      got = read(fd, &ram[addr], len);
+
+      if (got > 0 && isVideo(page))
+      {
+        for (ssize_t i = 0; i < got; ++i)
+          markDirty(addr + i);
+        redraw |= realWriters[page] == writeVideo;
+      }
+    }
+    else
+    {
+      uint8_t buffer[1 << PageShift];
+      got = read(fd, buffer, len);
+
+      for (ssize_t i = 0; i < got; ++i)
+        writeRam(addr + i, buffer[i]);
+    }
+
+    if (got <= 0)
+      break;
+
+    addr += got;
+    done += got;
+  }
+
+  if (redraw)
+    updateScreen();
+
+  return done;
+}
+
+unsigned writeRamToFile(int fd, uint16_t addr, unsigned count)
+{
+  unsigned done = 0;
+
+  while (done < count)
+  {
+    const uint8_t *page = pageReaders[addr >> PageShift];
+    unsigned len = min(count - done, pageLeft(addr, 1));
+    uint8_t buffer[1 << PageShift];
+
+    if (!page)
+    {
+      for (unsigned i = 0; i < len; ++i)
+        buffer[i] = readRam(addr + i);
+    }
+
+    ssize_t put = write(fd, page ? &page[addr & PageMask] : buffer, len);
+    if (put <= 0)
+      break;
+
+    addr += put;
+    done += put;
+  }
+
+  return done;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Report memory accesses in the pages covering first..last to the hook
+// before they happen, or stop reporting if the hook is null.
+//
+//-------------------------------------------------------------------------
+
+void hookWrites(WriteHandler hook, uint16_t first, uint16_t last)
+{
+  writeHook = hook;
+
+  for (int page = 0; page < NumPages; ++page)
+  {
+    if (!hook)
+      pageWriters[page] = realWriters[page];
+    else if (page >= (first >> PageShift) && page <= (last >> PageShift))
+      pageWriters[page] = writeHooked;
+  }
+}
+
+void hookReads(ReadHook hook, uint16_t first, uint16_t last)
+{
+  readHook = hook;
+
+  for (int page = 0; page < NumPages; ++page)
+  {
+    if (!hook)
+      pageReaders[page] = pageStorage(page);
+    else if (page >= (first >> PageShift) && page <= (last >> PageShift))
+      pageReaders[page] = nullptr;
+  }
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run without a terminal, the screen is never drawn.
+//
+//-------------------------------------------------------------------------
+
+void setHeadless()
+{
+  for (int page = 0; page < NumPages; ++page)
+  {
+    if (realWriters[page] != writeVideo)
+      continue;
+
+    realWriters[page] = writeVideoHeadless;
+    if (pageWriters[page] == writeVideo)
+      pageWriters[page] = writeVideoHeadless;
+  }
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Switch this thread over to another machine's memory. Hooks aren't
+// carried over, they belong to the main machine.
+//
+//-------------------------------------------------------------------------
+
+void useMemory(uint8_t *storage)
+{
+  ram = storage;
+
+  for (int page = 0; page < NumPages; ++page)
+    pageReaders[page] = pageStorage(page);
+}
+
+uint8_t *currentMemory()
+{
+  return ram;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Move the ROMs into a read-only region of their own that every machine
+// reads from. The pages come from mmap(), so the ones outside the ROMs,
+// and the ROM pages of each machine's storage, are never backed by real
+// memory.
+//
+//-------------------------------------------------------------------------
+
+void shareRoms()
+{
+  if (sharedRoms)
+    return;
+
+  void *region = mmap(nullptr, 64*1024, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+  {
+    cerr << "Cannot map the ROMs" << endl;
+    exit(1);
+  }
+
+  uint8_t *roms = static_cast<uint8_t *>(region);
+
+  for (int page = 0; page < NumPages; ++page)
+    if (isRom(page))
+      memcpy(&roms[page << PageShift], &ram[page << PageShift], 1 << PageShift);
+
+  mprotect(region, 64*1024, PROT_READ);
+  sharedRoms = roms;
+
+  useMemory(ram);
+}
+
+//-------------------------------------------------------------------------
+//
+// Memory that lives in a file. Writes land in the file's pages as they
+// happen, msync() only decides when they reach the disk.
+//
+//-------------------------------------------------------------------------
+
+static void syncAtExit()
+{
+  syncRamFile(true);
+}
+
+void mapRamFile(const string &filename)
+{
+  int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+  struct stat st;
+
+  // Only a new (empty) file is grown, anything else has to be a saved
+  // 64K already
+
+  if (fd < 0 || fstat(fd, &st) < 0 ||
+      (st.st_size == 0 ? ftruncate(fd, 64*1024) < 0 : st.st_size != 64*1024))
+  {
+    cerr << "Cannot keep the RAM in " << filename << endl;
+    exit(1);
+  }
+
+  void *region = mmap(nullptr, 64*1024, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (region == MAP_FAILED)
+  {
+    cerr << "Cannot map " << filename << endl;
+    exit(1);
+  }
+
+  uint8_t *storage = static_cast<uint8_t *>(region);
+  bool fresh = st.st_size == 0;
+
+  for (int page = 0; page < NumPages; ++page)
+    if (fresh || isRom(page))
+      memcpy(&storage[page << PageShift], &ram[page << PageShift], 1 << PageShift);
+
+  mappedRam = storage;
+  useMemory(storage);
+
+  atexit(syncAtExit);
+}
+
+void syncRamFile(bool wait)
+{
+  if (mappedRam)
+    msync(mappedRam, 64*1024, wait ? MS_SYNC : MS_ASYNC);
+}
+
+uint8_t *newMemory(const uint8_t *from)
+{
+  if (!from)
+    from = ram;
+
+  void *region = mmap(nullptr, 64*1024, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (region == MAP_FAILED)
+  {
+    cerr << "Cannot allocate memory for a machine" << endl;
+    exit(1);
+  }
+
+  uint8_t *storage = static_cast<uint8_t *>(region);
+
+  // The new pages read as zero, so blank ones aren't copied and stay
+  // unbacked until the machine writes to them
+
+  static const uint8_t blank[1 << PageShift] = {0};
+
+  for (int page = 0; page < NumPages; ++page)
+  {
+    const uint8_t *source = &from[page << PageShift];
+
+    if ((!sharedRoms || !isRom(page)) && memcmp(source, blank, sizeof(blank)) != 0)
+      memcpy(&storage[page << PageShift], source, sizeof(blank));
+  }
+
+  return storage;
+}
+
+void deleteMemory(uint8_t *storage)
+{
+  munmap(storage, 64*1024);
+}
+
+uint8_t readMemory(const uint8_t *storage, uint16_t addr)
+{
+  if (sharedRoms && isRom(addr >> PageShift))
+    return sharedRoms[addr];
+
+  return storage[addr];
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Read back what's on the screen.
+//
+//-------------------------------------------------------------------------
+
+uint16_t takeDirtyLines()
+{
+  uint16_t lines = dirtyLines;
+  dirtyLines = 0;
+
+  return lines;
+}
+
+string screenLine(int line)
+{
+  string text(48, ' ');
+
+  for (int x = 0; x < 48; ++x)
+    text[x] = printable(ram[VideoStart + line*64 + x]);
+
+  return text;
+}
+
+bool findOnScreen(const string &text, uint16_t lines)
+{
+  for (int line = 0; lines; ++line, lines >>= 1)
+    if ((lines & 1) && screenLine(line).find(text) != string::npos)
+      return true;
+
+  return false;
+}
+
+string screenText()
+{
+  // Line 15 is displayed at the top, see updateScreen()
+
+  string text = screenLine(15) + "\n";
+
+  for (int y = 0; y < 15; ++y)
+    text += screenLine(y) + "\n";
+
+  return text;
 }
 
 
@@ -100,7 +692,7 @@ void writeRam(uint16_t addr, uint8_t val)
 //
 //-------------------------------------------------------------------------
 
-void loadNasFile(const string &filename)
+LoadedRange loadNasFile(const string &filename)
 {
   ifstream f(filename, std::fstream::in);
   if (!f.is_open())
@@ -109,11 +701,13 @@ void loadNasFile(const string &filename)
     exit(1);
   }
 
+  LoadedRange range = { 0xffff, 0 };
+
   string line;
   while (getline(f, line))
   {
     if (line[0] == '.')
-      return;
+      return range;
 
     uint16_t addr;
     uint8_t  v[8];
@@ -129,6 +723,11 @@ void loadNasFile(const string &filename)
       ram[addr+5] = v[5];
       ram[addr+6] = v[6];
       ram[addr+7] = v[7];
+
+      if (addr < range.first)
+        range.first = addr;
+      if (addr + 7 > range.last)
+        range.last = addr + 7;
     }
     else
     {
@@ -136,4 +735,6 @@ void loadNasFile(const string &filename)
       exit(1);
     }
   }
+
+  return range;
 }
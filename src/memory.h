@@ -0,0 +1,91 @@
+//-------------------------------------------------------------------------
+//
+// The NASCOM memory map, see memory.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+#include <string>
+
+typedef void (*WriteHandler)(uint16_t addr, uint8_t val);
+typedef void (*ReadHook)(uint16_t addr);
+
+// The lowest and highest addresses a file loaded
+
+struct LoadedRange
+{
+  uint16_t first, last;
+};
+
+// Load a .nas format file into the memory
+
+LoadedRange loadNasFile(const std::string &filename);
+
+// Report memory writes (or reads) in the pages covering first..last to
+// hook, before they happen. All the hooked pages share the one hook, and a
+// null hook stops the reporting everywhere. The hook has to check the
+// address itself if it only wants part of a page.
+
+void hookWrites(WriteHandler hook, uint16_t first = 0, uint16_t last = 0xffff);
+void hookReads(ReadHook hook, uint16_t first = 0, uint16_t last = 0xffff);
+
+// Read up to count bytes from the file fd into memory at addr, or write
+// count bytes from addr to it, and say how many went. The memory behaves
+// as it would for the processor, ROM can't be loaded over and hooks are
+// told. count mustn't take it past the top of memory.
+
+unsigned readFileIntoRam(int fd, uint16_t addr, unsigned count);
+unsigned writeRamToFile(int fd, uint16_t addr, unsigned count);
+
+// Switch this thread to another machine's 64K of memory, and get at the
+// current machine's
+
+void useMemory(uint8_t *storage);
+uint8_t *currentMemory();
+
+// Keep the RAM in a file, mapped shared so it outlives the process and
+// other processes can watch it live. A new file starts as the memory is
+// now, an existing one brings back the RAM it had with the ROMs as they
+// are now. syncRamFile() asks for it to be written to the file (and waits
+// if wait is set), it's done every frame and at exit anyway.
+
+void mapRamFile(const std::string &filename);
+void syncRamFile(bool wait);
+
+// Once the ROMs are loaded, keep a single read-only copy of them for every
+// machine to share
+
+void shareRoms();
+
+// Memory for another machine, starting as a copy of from (or the current
+// machine). After shareRoms() only the RAM is copied and backed by memory.
+
+uint8_t *newMemory(const uint8_t *from = nullptr);
+void deleteMemory(uint8_t *storage);
+
+// Read another machine's memory without switching to it
+
+uint8_t readMemory(const uint8_t *storage, uint16_t addr);
+
+// Stop drawing the screen on the terminal, for running without one
+
+void setHeadless();
+
+// Bit n is set for each screen line n that has been written since the last
+// call (line 15 is the one displayed at the top)
+
+uint16_t takeDirtyLines();
+
+// One line of the screen, or the whole screen in display order, as text
+
+std::string screenLine(int line);
+std::string screenText();
+
+// Is text on any of the lines with their bit set in lines
+
+bool findOnScreen(const std::string &text, uint16_t lines = 0xffff);
+
+#endif
@@ -0,0 +1,109 @@
+//-------------------------------------------------------------------------
+//
+// Disassemble .nal images, for example the NAS-SYS and BASIC ROMs.
+//
+// Usage: nasdis [-s symbols]... [-a start] [-e end] file.nal...
+//
+//-------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "disasm.h"
+#include "memory.h"
+#include "symbols.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+static void usage()
+{
+	fprintf(stderr,
+		"Usage: nasdis [-s symbols]... [-a start] [-e end] file.nal...\n"
+		"  -s file   load a label/address symbol map, can be repeated\n"
+		"  -a addr   first address to disassemble (default the lowest loaded)\n"
+		"  -e addr   last address to disassemble (default the highest loaded)\n");
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	long start = -1;
+	long end = -1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:a:e:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			loadSymbols(optarg);
+			break;
+
+		case 'a':
+			start = strtol(optarg, nullptr, 16);
+			break;
+
+		case 'e':
+			end = strtol(optarg, nullptr, 16);
+			break;
+
+		default:
+			usage();
+		}
+	}
+
+	if (optind == argc)
+		usage();
+
+	LoadedRange loaded = { 0xffff, 0 };
+
+	for (int i = optind; i < argc; ++i)
+	{
+		LoadedRange range = loadNasFile(argv[i]);
+
+		if (range.first < loaded.first)
+			loaded.first = range.first;
+		if (range.last > loaded.last)
+			loaded.last = range.last;
+	}
+
+	if (start < 0)
+		start = loaded.first;
+	if (end < 0)
+		end = loaded.last;
+
+	// One instruction per line, with a label line wherever a symbol is
+
+	long addr = start;
+	while (addr <= end && addr <= 0xffff)
+	{
+		uint8_t bytes[4];
+		for (int i = 0; i < 4; ++i)
+			bytes[i] = readRam(addr + i);
+
+		int index = symbolIndex(addr);
+		if (index >= 0 && symbolAddress(index) == addr)
+			printf("%s:\n", symbolName(index).c_str());
+
+		char text[DisasmTextSize];
+		int length = disassemble(bytes, addr, text);
+
+		printf("%04lX  ", addr);
+		for (int i = 0; i < 4; ++i)
+		{
+			if (i < length)
+				printf("%02X ", bytes[i]);
+			else
+				printf("   ");
+		}
+		printf(" %s\n", text);
+
+		addr += length;
+	}
+
+	return 0;
+}
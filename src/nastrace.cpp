@@ -0,0 +1,125 @@
+//-------------------------------------------------------------------------
+//
+// Decode a trace dump written by nascom -t into readable text.
+//
+// Usage: nastrace [-s symbols]... dumpfile
+//
+//-------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+#include "disasm.h"
+#include "symbols.h"
+#include "trace.h"
+
+using namespace std;
+
+
+//-------------------------------------------------------------------------
+//
+// One line per record. Writes are indented under the instruction that
+// made them.
+//
+//-------------------------------------------------------------------------
+
+static void printRecord(const TraceRecord &r)
+{
+	switch (r.kind)
+	{
+	case TraceInstruction:
+	{
+		char text[DisasmTextSize];
+		disassemble(r.bytes, r.addr, text);
+
+		printf("%04X  %02X %02X %02X %02X  %-18s  "
+			"AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X IX=%04X IY=%04X  T=%04X\n",
+			r.addr, r.bytes[0], r.bytes[1], r.bytes[2], r.bytes[3], text,
+			r.af, r.bc, r.de, r.hl, r.sp, r.ix, r.iy, r.ticks);
+		break;
+	}
+
+	case TraceWrite:
+		printf("      (%04X) <- %02X\n", r.addr, r.value);
+		break;
+
+	default:
+		printf("      unknown record kind %d\n", r.kind);
+	}
+}
+
+
+static void usage(const char *program)
+{
+	fprintf(stderr, "usage: %s [-s symbols]... dumpfile\n", program);
+	exit(1);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1)
+	{
+		if (opt != 's')
+			usage(argv[0]);
+
+		loadSymbols(optarg);
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	const char *name = argv[optind];
+
+	FILE *f = fopen(name, "rb");
+	if (!f)
+	{
+		fprintf(stderr, "Cannot open %s\n", name);
+		return 1;
+	}
+
+	TraceHeader header;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+		memcmp(header.magic, TraceMagic, sizeof(header.magic)) != 0)
+	{
+		fprintf(stderr, "%s is not a trace dump\n", name);
+		return 1;
+	}
+
+	if (header.version != TraceVersion || header.recordSize != sizeof(TraceRecord))
+	{
+		fprintf(stderr, "%s is trace version %u, expected %u\n",
+			name, header.version, TraceVersion);
+		return 1;
+	}
+
+	// Read in big chunks, dumps can be tens of megabytes
+
+	vector<TraceRecord> records(64*1024);
+	uint64_t left = header.count;
+
+	while (left > 0)
+	{
+		size_t want = (left < records.size()) ? left : records.size();
+		size_t got = fread(records.data(), sizeof(TraceRecord), want, f);
+
+		for (size_t i = 0; i < got; ++i)
+			printRecord(records[i]);
+
+		if (got < want)
+		{
+			fprintf(stderr, "%s is truncated\n", name);
+			return 1;
+		}
+
+		left -= got;
+	}
+
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,144 @@
+//-------------------------------------------------------------------------
+//
+// Watch a machine through the shared memory it publishes with -v (see
+// view.cpp), from another terminal.
+//
+// Usage: nasview [-1] name
+//
+// The screen and registers are redrawn whenever a new frame comes out.
+// -1 prints the latest frame once, as text, and exits.
+//
+//-------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "view.h"
+
+using namespace std;
+
+
+//-------------------------------------------------------------------------
+//
+// Print a frame, line 15 first as on the real screen.
+//
+//-------------------------------------------------------------------------
+
+static void printLine(const ViewFrame &f, int line)
+{
+	const uint8_t *text = &f.video[0x0a + line * 64];
+
+	for (int x = 0; x < 48; ++x)
+		putchar(max(text[x] & 0x7f, 0x20));
+
+	putchar('\n');
+}
+
+static void printFrame(const ViewFrame &f)
+{
+	printLine(f, 15);
+	for (int line = 0; line < 15; ++line)
+		printLine(f, line);
+
+	printf("frame %llu  T=%llu\n", (unsigned long long) f.frame, (unsigned long long) f.cycles);
+	printf("AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SP=%04X PC=%04X\n",
+		f.af, f.bc, f.de, f.hl, f.ix, f.iy, f.sp, f.pc);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Start up.
+//
+//-------------------------------------------------------------------------
+
+static const ViewSegment *attach(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(ViewSegment))
+	{
+		fprintf(stderr, "Cannot open %s\n", name);
+		exit(1);
+	}
+
+	void *region = mmap(nullptr, sizeof(ViewSegment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (region == MAP_FAILED)
+	{
+		fprintf(stderr, "Cannot map %s\n", name);
+		exit(1);
+	}
+
+	const ViewSegment *segment = static_cast<const ViewSegment *>(region);
+
+	if (memcmp(segment->magic, ViewMagic, sizeof(ViewMagic)) != 0 ||
+		segment->version != ViewVersion || segment->size != sizeof(ViewSegment))
+	{
+		fprintf(stderr, "%s isn't a view this understands\n", name);
+		exit(1);
+	}
+
+	return segment;
+}
+
+static void usage()
+{
+	fprintf(stderr, "Usage: nasview [-1] name\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	bool once = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "1")) != -1)
+	{
+		switch (c)
+		{
+		case '1':
+			once = true;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1)
+		usage();
+
+	const ViewSegment *segment = attach(argv[optind]);
+	ViewFrame frame;
+	uint64_t shown = UINT64_MAX;
+
+	if (!once)
+		printf("\033[2J");
+
+	while (1)
+	{
+		if (readView(segment, frame) && frame.frame != shown)
+		{
+			if (once)
+			{
+				printFrame(frame);
+				return 0;
+			}
+
+			printf("\033[H");
+			printFrame(frame);
+			fflush(stdout);
+			shown = frame.frame;
+		}
+
+		usleep(10000);
+	}
+}
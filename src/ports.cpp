@@ -1,14 +1,16 @@
+#include <algorithm>
 #include <cstdio>
 #include <queue>
 #include <stdint.h>
 #include <sys/ioctl.h>
 #include <termios.h>
-#include <time.h>
 #include <iostream> //??
 
-using namespace std;
+#include "events.h"
+#include "ports.h"
+#include "z80-simulator.h"
 
-extern void instructionDelay();
+using namespace std;
 
 
 //-------------------------------------------------------------------------
@@ -20,65 +22,156 @@ extern void instructionDelay();
 //
 //-------------------------------------------------------------------------
 
-static uint8_t keyMatrix[9] =	{0};
-static uint8_t keyRow = 0;
+// Everything one machine's keyboard remembers. There's normally just the
+// one, the server switches between them with useKeyboard().
+
+struct Keyboard
+{
+  uint8_t matrix[9] = {0};
+  uint8_t row = 0;
+  uint8_t prevPort = 0;    // Last value written to port 0
+
+  queue<uint8_t> keys;     // Typed but not pressed yet
+
+  bool busy = false;       // Waiting for the key to come up, or for the gap after it
+  bool gapDone = false;
+};
+
+static Keyboard mainKeyboard;
+static machine_local Keyboard *keyboard = &mainKeyboard;
 
 
 //-------------------------------------------------------------------------
 //
-// Handle the port OUT instruction.
+// The keyboard's port, 0.
 //
 //-------------------------------------------------------------------------
 
-extern "C"  //??
-void portOut(uint8_t port, uint8_t value)
+static void keyboardOut(uint8_t port, uint8_t value)
 {
-  static uint8_t prevPort = 0;
-  uint8_t highToLow;
+  // Port 0 is for driving the keyboard rows
 
-  switch (port) {
-  case 0:   // Port 0 is for driving the keyboard rows
-    highToLow = prevPort & ~value; // Which bits transitioned from H to L?
+  uint8_t highToLow = keyboard->prevPort & ~value; // Which bits transitioned from H to L?
 
-    // If the low bit transitioned from high to low,
-    // then increment the row index
+  // If the low bit transitioned from high to low,
+  // then increment the row index
 
-    if ((highToLow & 0x01) && keyRow < 9)
-      ++keyRow;
+  if ((highToLow & 0x01) && keyboard->row < 9)
+    ++keyboard->row;
 
-    // If the next bit transitioned, then reset the row index
+  // If the next bit transitioned, then reset the row index
 
-    if (highToLow & 0x02)
-      keyRow = 0;
+  if (highToLow & 0x02)
+    keyboard->row = 0;
 
-    // Remember for next time
+  // Remember for next time
 
-    prevPort = value;
-    break;
+  keyboard->prevPort = value;
+}
 
-  default:  // We don't simulation any other ports
-    break;
-  }
+bool tapeMotorOn()
+{
+  // Port 0 also drives the tape motor relay (and the LED beside it)
+
+  return keyboard->prevPort & 0x10;
+}
+
+static uint8_t keyboardIn(uint8_t port)
+{
+  // Port 0 is for reading the keyboard columns of the selected row
+
+  return ~keyboard->matrix[keyboard->row];
 }
 
 
 //-------------------------------------------------------------------------
 //
-// Handle the port IN instruction.
+// The port bus. Each of the 256 ports has its device's handlers in these
+// tables, and IN and OUT go straight through them. A port without a
+// device reads as 0 and ignores what's written to it. The tables are
+// shared by every machine, a device keeps each machine's state itself.
 //
 //-------------------------------------------------------------------------
 
+static uint8_t noDeviceIn(uint8_t port)
+{
+  return 0;
+}
+
+static void noDeviceOut(uint8_t port, uint8_t value)
+{
+}
+
+static PortReader portReaders[256];
+static PortWriter portWriters[256];
+static PortBlockReader blockReaders[256];
+static PortBlockWriter blockWriters[256];
+
+void attachDevice(uint8_t first, uint8_t last, const PortDevice &device)
+{
+  for (int port = first; port <= last; ++port)
+  {
+    portReaders[port] = device.in ? device.in : noDeviceIn;
+    portWriters[port] = device.out ? device.out : noDeviceOut;
+    blockReaders[port] = device.inBlock;
+    blockWriters[port] = device.outBlock;
+  }
+}
+
+static struct PortMap
+{
+  PortMap()
+  {
+    attachDevice(0, 255, PortDevice());
+    attachDevice(0, 0, { keyboardIn, keyboardOut });
+  }
+} portMap;
+
+
+extern "C"  //??
+void portOut(uint8_t port, uint8_t value)
+{
+  portWriters[port](port, value);
+}
+
 extern "C" //??
 uint8_t portIn(uint8_t port)
 {
-  switch (port)
-  {
-  case 0:   // Port 0 is for reading the keyboard columns of the selected row
-    return ~keyMatrix[keyRow];
+  return portReaders[port](port);
+}
+
 
-  default:  // We don't simulation any other ports
+// The block instructions, for devices that can move more than a byte at a
+// time. The bytes go through a buffer on their way to or from memory.
+
+extern "C"
+unsigned portInBlock(uint8_t port, uint16_t addr, unsigned count, int step)
+{
+  if (!blockReaders[port])
     return 0;
-  }
+
+  uint8_t buffer[256];
+  unsigned done = blockReaders[port](port, buffer, min(count, 256u));
+
+  for (unsigned i = 0; i < done; ++i)
+    writeRam(addr + step * (int) i, buffer[i]);
+
+  return done;
+}
+
+extern "C"
+unsigned portOutBlock(uint8_t port, uint16_t addr, unsigned count, int step)
+{
+  if (!blockWriters[port])
+    return 0;
+
+  uint8_t buffer[256];
+  count = min(count, 256u);
+
+  for (unsigned i = 0; i < count; ++i)
+    buffer[i] = readRam(addr + step * (int) i);
+
+  return blockWriters[port](port, buffer, count);
 }
 
 
@@ -113,7 +206,7 @@ void setUnbufferedInput()
 
 static int numCharsAvailable()
 {
-    int n;
+    int n = 0;
     ioctl(fileno(stdin), FIONREAD, &n);
 
     return n;
@@ -123,39 +216,29 @@ static int numCharsAvailable()
 //-------------------------------------------------------------------------
 //
 // Unfortunately, without raw keyboard input, we only know when a key is
-// pressed, not when it is released. So pretend each key is pressed for
-// 100ms before being released.
-//
-// Returns true if we are still waiting for the key to be released.
+// pressed, not when it is released. So pretend each key is held for a
+// while before being released, and leave a gap before the next one so
+// NAS-SYS sees every key go up. Both are timed on the emulated clock, by
+// an event, and are about 20ms each at 4MHz.
 //
 //-------------------------------------------------------------------------
 
-static struct timespec lastTime = {0, 0};
+const uint64_t KeyCycles = 80000;
 
-static bool keyDelay()
-{
-  // No timeout => no key pressed
-
-	if ((lastTime.tv_sec == 0) && (lastTime.tv_nsec == 0))
-		return false;
-
-  // Have we waited long enough?
-
-	struct timespec currTime;
-	clock_gettime(CLOCK_REALTIME, &currTime);
+static void keyEvent();
 
-	if (((currTime.tv_sec - lastTime.tv_sec) * 1000000000
-		+ (currTime.tv_nsec - lastTime.tv_nsec)) > 100000000)
-	{
-    // Timed-out, we've waited long enough
-
-		lastTime = {0, 0};
-		return false;
-	}
+static void keyAfter(uint64_t count)
+{
+  keyboard->busy = true;
+  scheduleEvent(z80cycles() + count, keyEvent);
+}
 
-  // Still waiting for the key to be released
+// A key has been typed, get it going if the keyboard is idle
 
-	return true;
+static void keyTyped()
+{
+  if (!keyboard->busy)
+    keyEvent();
 }
 
 
@@ -245,39 +328,60 @@ static uint8_t getKey(int numChars)
 //-------------------------------------------------------------------------
 //
 // Handle any keyboard input. Converts the ASCII character to the
-// appropriate row and column in the keyboard map.
+// appropriate row and column in the keyboard map. The terminal is checked
+// again every PollCycles from then on.
 //
 //-------------------------------------------------------------------------
 
-static queue<uint8_t> keyQueue;
+const uint64_t PollCycles = 4000;
 
 void pollKeyboard()
 {
-  instructionDelay();
-
 	int n = numCharsAvailable();
 	if (n > 0)
   {
     uint8_t key = getKey(n);
 
     if (key != 0)
-      keyQueue.push(key);
+    {
+      keyboard->keys.push(key);
+      keyTyped();
+    }
   }
 
-	if (keyDelay())
-		return;
+  scheduleEvent(z80cycles() + PollCycles, pollKeyboard);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The last key has been held long enough (or the keyboard was idle), let
+// it go and press the next queued one.
+//
+//-------------------------------------------------------------------------
+
+static void keyEvent()
+{
+  keyboard->busy = false;
 
   // Erase the previous pressed key, but not the shift state
 
 	for (int i = 1; i < 9; ++i)
-	  keyMatrix[i] = 0;
+	  keyboard->matrix[i] = 0;
 
   // If there are no more letters in the queue,
   // then erase the shift state too
 
-  if (keyQueue.empty())
+  if (keyboard->keys.empty())
+  {
+		keyboard->matrix[0] = 0;
+    return;
+  }
+
+  if (!keyboard->gapDone)
   {
-		keyMatrix[0] = 0;
+    keyboard->gapDone = true;
+    keyAfter(KeyCycles);
     return;
   }
 
@@ -285,21 +389,70 @@ void pollKeyboard()
   // toggle the shift key and leave the pressed key for the
   // next time through.
 
-  uint8_t &key = keyQueue.front();
+  uint8_t &key = keyboard->keys.front();
 
   int row    = 9 - ((key & 0x78) >> 3); // Invert the row
   int col    = key & 0x07;
   bool shift = key & 0x80;
 
-  if (bool(keyMatrix[0] & (1 << 4)) != shift)
-    keyMatrix[0] ^= (1 << 4);  // Toggle shift key
+  if (bool(keyboard->matrix[0] & (1 << 4)) != shift)
+    keyboard->matrix[0] ^= (1 << 4);  // Toggle shift key
   else
   {
-	  keyMatrix[row] |= (1 << col);
-    keyQueue.pop();
+	  keyboard->matrix[row] |= (1 << col);
+    keyboard->keys.pop();
+  }
+
+  // Hold it down for a while
+
+  keyboard->gapDone = false;
+  keyAfter(KeyCycles);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Scripted input.
+//
+//-------------------------------------------------------------------------
+
+void typeKeys(const string &text)
+{
+  for (char ch : text)
+  {
+    uint8_t key = keyMap[ch & 0x7f];
+
+    if (key != 0)
+      keyboard->keys.push(key);
   }
 
-  // Remember when the key was pressed
+  if (!keyboard->keys.empty())
+    keyTyped();
+}
+
+bool keysPending()
+{
+  return !keyboard->keys.empty() || keyboard->busy;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// More than one machine.
+//
+//-------------------------------------------------------------------------
+
+Keyboard *newKeyboard()
+{
+  return new Keyboard;
+}
 
-	clock_gettime(CLOCK_REALTIME, &lastTime);
+void deleteKeyboard(Keyboard *k)
+{
+  delete k;
+}
+
+void useKeyboard(Keyboard *k)
+{
+  keyboard = k ? k : &mainKeyboard;
 }
@@ -0,0 +1,68 @@
+//-------------------------------------------------------------------------
+//
+// The NASCOM keyboard and I/O ports, see ports.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef PORTS_H
+#define PORTS_H
+
+#include <stdint.h>
+#include <string>
+
+// The devices on the I/O ports. in and out handle IN and OUT a byte at a
+// time. inBlock and outBlock are optional, they move up to count bytes in
+// one go for INIR, OTIR and the rest, and return how many they moved (0
+// to fall back to in and out).
+
+typedef uint8_t  (*PortReader)(uint8_t port);
+typedef void     (*PortWriter)(uint8_t port, uint8_t value);
+typedef unsigned (*PortBlockReader)(uint8_t port, uint8_t *buffer, unsigned count);
+typedef unsigned (*PortBlockWriter)(uint8_t port, const uint8_t *buffer, unsigned count);
+
+struct PortDevice
+{
+  PortReader      in = nullptr;
+  PortWriter      out = nullptr;
+  PortBlockReader inBlock = nullptr;
+  PortBlockWriter outBlock = nullptr;
+};
+
+// Put a device on ports first..last, replacing whatever was there. This is
+// done while the machine is being put together, before it runs. The
+// keyboard is on port 0 from the start.
+
+void attachDevice(uint8_t first, uint8_t last, const PortDevice &device);
+
+// Is the tape motor on? It's bit 4 of port 0, which NAS-SYS turns on
+// for the R and W commands (see cassette.cpp).
+
+bool tapeMotorOn();
+
+// Read the terminal a key at a time, without echo
+
+void setUnbufferedInput();
+
+// Feed any typed keys to the keyboard matrix. Once called it keeps
+// checking the terminal every so often, as an event (see events.h).
+// Pressing and releasing the keys is timed by events too, on the emulated
+// clock.
+
+void pollKeyboard();
+
+// Type text as if it came from the terminal, and check whether it has all
+// gone through the keyboard yet
+
+void typeKeys(const std::string &text);
+bool keysPending();
+
+// Each machine in the server has its own keyboard, switched in before it
+// runs. Null goes back to the built-in one.
+
+struct Keyboard;
+
+Keyboard *newKeyboard();
+void deleteKeyboard(Keyboard *k);
+void useKeyboard(Keyboard *k);
+
+#endif
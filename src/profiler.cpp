@@ -0,0 +1,594 @@
+//-------------------------------------------------------------------------
+//
+// Execution profiler. Counts how often each opcode runs (for every prefix
+// page) and how many T-states are spent at each address, then reports the
+// hot spots and which part of memory they are in.
+//
+// With a symbol map loaded, time is also charged to routines. A shadow
+// call stack follows CALL, RST and RET so that each routine gets both its
+// own time and the time of everything it calls, and the stacks can be
+// written in the folded format used by flame graph tools.
+//
+// profileStep() wraps z80step(). The main loop is instantiated for one or
+// the other at start-up, so an unprofiled run doesn't pay anything.
+//
+//-------------------------------------------------------------------------
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+#include "disasm.h"
+#include "profiler.h"
+#include "symbols.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+enum Page { MainPage, CBPage, EDPage, DDPage, FDPage, DDCBPage, FDCBPage, NumPages };
+
+static const char *pageNames[NumPages] = { "", "CB ", "ED ", "DD ", "FD ", "DDCB ", "FDCB " };
+
+static uint64_t opcodeCounts[NumPages][256];
+static uint64_t pcCounts[64*1024];
+static uint64_t pcCycles[64*1024];
+
+static string reportFile;
+static string foldedFile;
+
+static volatile sig_atomic_t reportRequested = 0;
+static volatile sig_atomic_t exitRequested = 0;
+
+
+//-------------------------------------------------------------------------
+//
+// The interesting parts of the memory map.
+//
+//-------------------------------------------------------------------------
+
+struct Region
+{
+	const char *name;
+	uint16_t	first;
+	uint16_t	last;
+};
+
+static const Region regions[] =
+{
+	{ "NAS-SYS",	0x0000, 0x07ff },
+	{ "user RAM",	0x0800, 0xdfff },
+	{ "BASIC",		0xe000, 0xffff },
+};
+
+const int NumRegions = sizeof(regions) / sizeof(regions[0]);
+
+static int regionIndex(uint16_t addr)
+{
+	for (int r = 0; r < NumRegions; ++r)
+		if (addr >= regions[r].first && addr <= regions[r].last)
+			return r;
+
+	return 0;
+}
+
+static const char *regionName(uint16_t addr)
+{
+	return regions[regionIndex(addr)].name;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Routines are identified by their symbol index. A call to an address
+// without a symbol gets an id made from the address, and code that runs
+// outside any known routine is charged to its region.
+//
+//-------------------------------------------------------------------------
+
+const uint32_t AddressRoutine = 0x10000;
+const uint32_t RegionRoutine  = 0x20000;
+
+static uint32_t routineOf(uint16_t addr)
+{
+	int index = symbolIndex(addr);
+
+	return (index >= 0) ? index : AddressRoutine + addr;
+}
+
+static string routineName(uint32_t routine)
+{
+	if (routine < AddressRoutine)
+		return symbolName(routine);
+
+	if (routine < RegionRoutine)
+	{
+		char name[8];
+		snprintf(name, sizeof(name), "L%04X", routine - AddressRoutine);
+		return name;
+	}
+
+	return regions[routine - RegionRoutine].name;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The call tree. Each node is a routine reached through a particular chain
+// of calls, node 0 is the code that runs before anything is called. The
+// shadow stack remembers the SP of each call so that we can resync when
+// the guest code plays games with its stack.
+//
+//-------------------------------------------------------------------------
+
+struct Node
+{
+	uint32_t	routine;
+	int			parent;
+	uint64_t	calls;
+
+	unordered_map<uint32_t, int> children;
+};
+
+struct Frame
+{
+	int			node;
+	uint16_t	sp;		// Where the return address was pushed
+};
+
+const size_t MaxDepth = 512;
+
+static vector<Node>  nodes = { { RegionRoutine, -1, 0, {} } };
+static vector<Frame> callStack;
+static int currentNode = 0;
+
+// T-states for each (call tree node, routine containing the PC) pair
+
+static unordered_map<uint64_t, uint64_t> samples;
+
+static bool isCall(uint8_t op)
+{
+	return (op == 0xcd) || ((op & 0xc7) == 0xc4) || ((op & 0xc7) == 0xc7);
+}
+
+static bool isReturn(uint8_t op, uint8_t next)
+{
+	return (op == 0xc9) || ((op & 0xc7) == 0xc0) ||
+		((op == 0xed) && ((next & 0xc7) == 0x45));
+}
+
+static void enterRoutine(uint16_t addr, uint16_t sp)
+{
+	// Anything at or below the new return address has been abandoned
+
+	while (!callStack.empty() && callStack.back().sp <= sp)
+		callStack.pop_back();
+
+	currentNode = callStack.empty() ? 0 : callStack.back().node;
+
+	if (callStack.size() >= MaxDepth)
+		return;
+
+	uint32_t routine = routineOf(addr);
+	auto child = nodes[currentNode].children.find(routine);
+	int node;
+
+	if (child != nodes[currentNode].children.end())
+		node = child->second;
+	else
+	{
+		node = nodes.size();
+		nodes.push_back({ routine, currentNode, 0, {} });
+		nodes[currentNode].children[routine] = node;
+	}
+
+	++nodes[node].calls;
+	callStack.push_back({ node, sp });
+	currentNode = node;
+}
+
+static void leaveRoutine(uint16_t sp)
+{
+	while (!callStack.empty() && callStack.back().sp < sp)
+		callStack.pop_back();
+
+	currentNode = callStack.empty() ? 0 : callStack.back().node;
+}
+
+static void chargeRoutine(uint16_t pc, uint64_t spent)
+{
+	uint32_t leaf;
+
+	if (symbolIndex(pc) >= 0)
+		leaf = symbolIndex(pc);
+	else if (currentNode != 0)
+		leaf = nodes[currentNode].routine;
+	else
+		leaf = RegionRoutine + regionIndex(pc);
+
+	samples[(uint64_t(currentNode) << 32) | leaf] += spent;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Decode the prefixes of the instruction at addr and find the count for
+// its opcode, in the page it belongs to. For DD CB and FD CB the opcode comes
+// after the displacement byte.
+//
+//-------------------------------------------------------------------------
+
+static uint64_t &opcodeCount(uint16_t addr)
+{
+	Page page = MainPage;
+	uint8_t op = readRam(addr);
+
+	switch (op)
+	{
+	case 0xcb:
+		page = CBPage;
+		op = readRam(addr+1);
+		break;
+
+	case 0xed:
+		page = EDPage;
+		op = readRam(addr+1);
+		break;
+
+	case 0xdd:
+	case 0xfd:
+		page = (op == 0xdd) ? DDPage : FDPage;
+		op = readRam(addr+1);
+
+		if (op == 0xcb)
+		{
+			page = (page == DDPage) ? DDCBPage : FDCBPage;
+			op = readRam(addr+3);
+		}
+		break;
+	}
+
+	return opcodeCounts[page][op];
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Signals only set a flag, the work is done between instructions.
+//
+//-------------------------------------------------------------------------
+
+static void onSignal(int sig)
+{
+	if (sig == SIGUSR1)
+		reportRequested = 1;
+	else
+		exitRequested = 1;
+}
+
+static void handleSignals()
+{
+	if (reportRequested)
+	{
+		reportRequested = 0;
+		writeProfile();
+	}
+
+	if (exitRequested)
+		exit(0);	// The atexit handler writes the report
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Execute one instruction and charge its T-states to its address.
+//
+//-------------------------------------------------------------------------
+
+void profileStep()
+{
+	uint16_t pc = z80pc();
+	uint16_t sp = z80sp();
+	uint64_t start = z80cycles();
+	uint8_t  op = readRam(pc);
+	uint8_t  next = readRam(pc+1);
+
+	uint64_t interrupts = z80interrupts();
+
+	// The opcode is found before the step in case the instruction writes
+	// over itself, and only counted if it ran
+
+	uint64_t &opcode = opcodeCount(pc);
+
+	bool halted = z80halted();
+
+	z80step();
+
+	uint64_t spent = z80cycles() - start;
+
+	// Taking an interrupt runs nothing at pc either. It's a call to the
+	// handler (unless IM 0 put something else on the bus), which gets the
+	// T-states it took.
+
+	if (z80interrupts() != interrupts)
+	{
+		if (z80sp() == uint16_t(sp - 2))
+			enterRoutine(z80pc(), z80sp());
+
+		pcCycles[z80pc()] += spent;
+		chargeRoutine(z80pc(), spent);
+	}
+	else if (halted)
+	{
+		// Time parked at a HALT belongs to the HALT, PC is already past it
+
+		pcCycles[uint16_t(pc - 1)] += spent;
+		chargeRoutine(pc - 1, spent);
+	}
+	else
+	{
+		++opcode;
+		++pcCounts[pc];
+		pcCycles[pc] += spent;
+		chargeRoutine(pc, spent);
+
+		// Taken calls push a return address, taken returns pop one
+
+		if (isCall(op) && z80sp() == uint16_t(sp - 2))
+			enterRoutine(z80pc(), z80sp());
+		else if (isReturn(op, next) && z80sp() == uint16_t(sp + 2))
+			leaveRoutine(z80sp());
+	}
+
+	if (reportRequested | exitRequested)
+		handleSignals();
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Write the report: time per region, the hottest addresses and the most
+// executed opcodes.
+//
+//-------------------------------------------------------------------------
+
+static double percent(uint64_t part, uint64_t total)
+{
+	return total ? 100.0 * part / total : 0.0;
+}
+
+//-------------------------------------------------------------------------
+//
+// The routines on the call chain leading to a node, outermost first.
+//
+//-------------------------------------------------------------------------
+
+static vector<uint32_t> callChain(int node)
+{
+	vector<uint32_t> chain;
+
+	for (; node > 0; node = nodes[node].parent)
+		chain.push_back(nodes[node].routine);
+
+	reverse(chain.begin(), chain.end());
+	return chain;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Per-routine totals. Self time is where the PC was, inclusive time
+// counts a sample once for every routine on the call chain.
+//
+//-------------------------------------------------------------------------
+
+static void writeRoutines(ofstream &f, uint64_t total)
+{
+	struct Totals { uint64_t calls = 0, self = 0, inclusive = 0; };
+	map<uint32_t, Totals> routines;
+
+	for (size_t node = 1; node < nodes.size(); ++node)
+		routines[nodes[node].routine].calls += nodes[node].calls;
+
+	for (const auto &sample : samples)
+	{
+		int node = sample.first >> 32;
+		uint32_t leaf = sample.first & 0xffffffff;
+
+		vector<uint32_t> chain = callChain(node);
+		set<uint32_t> seen(chain.begin(), chain.end());
+		seen.insert(leaf);
+
+		routines[leaf].self += sample.second;
+		for (uint32_t routine : seen)
+			routines[routine].inclusive += sample.second;
+	}
+
+	vector<pair<uint32_t, Totals>> sorted(routines.begin(), routines.end());
+	sort(sorted.begin(), sorted.end(), [](const pair<uint32_t, Totals> &a,
+		const pair<uint32_t, Totals> &b) { return a.second.inclusive > b.second.inclusive; });
+
+	const size_t maxRoutines = 50;
+	if (sorted.size() > maxRoutines)
+		sorted.resize(maxRoutines);
+
+	f << "\nRoutine                Calls        Self       %   Inclusive       %\n";
+	for (const auto &r : sorted)
+		f << left << setw(16) << routineName(r.first) << right
+		  << setw(12) << r.second.calls
+		  << setw(12) << r.second.self
+		  << setw(8) << percent(r.second.self, total)
+		  << setw(12) << r.second.inclusive
+		  << setw(8) << percent(r.second.inclusive, total) << "\n";
+}
+
+
+//-------------------------------------------------------------------------
+//
+// One line per distinct call stack, "outer;inner;leaf T-states", which is
+// what flamegraph.pl and friends expect.
+//
+//-------------------------------------------------------------------------
+
+static void writeFolded()
+{
+	ofstream f(foldedFile);
+	if (!f.is_open())
+	{
+		cerr << "Cannot write folded stacks " << foldedFile << endl;
+		return;
+	}
+
+	map<string, uint64_t> stacks;
+
+	for (const auto &sample : samples)
+	{
+		int node = sample.first >> 32;
+		uint32_t leaf = sample.first & 0xffffffff;
+
+		vector<uint32_t> chain = callChain(node);
+		if (chain.empty() || chain.back() != leaf)
+			chain.push_back(leaf);
+
+		string stack;
+		for (uint32_t routine : chain)
+			stack += (stack.empty() ? "" : ";") + routineName(routine);
+
+		stacks[stack] += sample.second;
+	}
+
+	for (const auto &stack : stacks)
+		f << stack.first << " " << stack.second << "\n";
+}
+
+
+void writeProfile()
+{
+	if (!foldedFile.empty())
+		writeFolded();
+
+	ofstream f(reportFile);
+	if (!f.is_open())
+	{
+		cerr << "Cannot write profile " << reportFile << endl;
+		return;
+	}
+
+	uint64_t instructions = 0;
+	uint64_t total = 0;
+	vector<uint64_t> regionCycles(sizeof(regions) / sizeof(regions[0]), 0);
+	vector<uint16_t> hot;
+
+	for (int addr = 0; addr < 64*1024; ++addr)
+	{
+		if (pcCounts[addr] == 0)
+			continue;
+
+		instructions += pcCounts[addr];
+		total += pcCycles[addr];
+		hot.push_back(addr);
+
+		for (size_t r = 0; r < regionCycles.size(); ++r)
+			if (addr >= regions[r].first && addr <= regions[r].last)
+				regionCycles[r] += pcCycles[addr];
+	}
+
+	f << fixed << setprecision(2);
+	f << instructions << " instructions, " << total << " T-states\n\n";
+
+	// Where in memory the time went
+
+	f << "Region        T-states       %\n";
+	for (size_t r = 0; r < regionCycles.size(); ++r)
+		f << left << setw(10) << regions[r].name << right
+		  << setw(12) << regionCycles[r]
+		  << setw(8) << percent(regionCycles[r], total) << "\n";
+
+	// The hottest addresses
+
+	const size_t maxHot = 50;
+
+	sort(hot.begin(), hot.end(),
+		[](uint16_t a, uint16_t b) { return pcCycles[a] > pcCycles[b]; });
+	if (hot.size() > maxHot)
+		hot.resize(maxHot);
+
+	f << "\nAddress  Region          Count    T-states       %  Instruction\n";
+	for (uint16_t addr : hot)
+	{
+		uint8_t bytes[4];
+		for (int i = 0; i < 4; ++i)
+			bytes[i] = readRam(addr + i);
+
+		char text[DisasmTextSize];
+		disassemble(bytes, addr, text);
+
+		f << hex << uppercase << setfill('0') << setw(4) << addr
+		  << dec << setfill(' ') << "     " << left << setw(10) << regionName(addr)
+		  << right << setw(12) << pcCounts[addr]
+		  << setw(12) << pcCycles[addr]
+		  << setw(8) << percent(pcCycles[addr], total)
+		  << "  " << text << "\n";
+	}
+
+	// The most executed opcodes, across all the prefix pages
+
+	struct Opcode { int page; int op; };
+	vector<Opcode> ops;
+
+	for (int page = 0; page < NumPages; ++page)
+		for (int op = 0; op < 256; ++op)
+			if (opcodeCounts[page][op])
+				ops.push_back({ page, op });
+
+	const size_t maxOps = 50;
+
+	sort(ops.begin(), ops.end(), [](const Opcode &a, const Opcode &b)
+		{ return opcodeCounts[a.page][a.op] > opcodeCounts[b.page][b.op]; });
+	if (ops.size() > maxOps)
+		ops.resize(maxOps);
+
+	f << "\nOpcode          Count       %\n";
+	for (const Opcode &o : ops)
+	{
+		uint64_t count = opcodeCounts[o.page][o.op];
+
+		f << left << setw(5) << pageNames[o.page] << right
+		  << hex << uppercase << setfill('0') << setw(2) << o.op
+		  << dec << setfill(' ') << setw(15) << count
+		  << setw(8) << percent(count, instructions) << "\n";
+	}
+
+	writeRoutines(f, total);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Set up the report files and the signal handlers. SIGUSR1 writes a
+// report and carries on, SIGINT and SIGTERM write one and exit. The folded
+// stacks are only written if a file name is given.
+//
+//-------------------------------------------------------------------------
+
+void startProfiler(const string &filename, const string &folded)
+{
+	reportFile = filename;
+	foldedFile = folded;
+
+	struct sigaction sa = {};
+	sa.sa_handler = onSignal;
+	sigaction(SIGUSR1, &sa, nullptr);
+	sigaction(SIGINT, &sa, nullptr);
+	sigaction(SIGTERM, &sa, nullptr);
+
+	atexit(writeProfile);
+}
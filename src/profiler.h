@@ -0,0 +1,25 @@
+//-------------------------------------------------------------------------
+//
+// Execution profiler, see profiler.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+
+// Start collecting, the report (and optionally the folded call stacks for
+// a flame graph) is written on exit or SIGUSR1
+
+void startProfiler(const std::string &filename, const std::string &folded = "");
+
+// Drop-in replacement for z80step() which records where the time goes
+
+void profileStep();
+
+// Write the report now
+
+void writeProfile();
+
+#endif
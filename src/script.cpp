@@ -0,0 +1,195 @@
+//-------------------------------------------------------------------------
+//
+// Expect-style scripts. Each line is one step:
+//
+//   expect text     wait for text to appear on the screen
+//   type text       type text on the keyboard
+//   wait count      let count T-states go by
+//   timeout count   give up on an expect after count T-states
+//                   (default 100M, about 25 seconds of a 4MHz NASCOM)
+//
+// The text runs to the end of the line and can be in double quotes to
+// keep leading or trailing spaces. \n (Enter), \r, \t, \" and \\ work as
+// in C. Blank lines and lines starting with '#' are skipped.
+//
+// Scripts run flat out, so a step finishes as soon as it can. Waiting
+// for the screen only looks at the lines that have changed since the last
+// match, never the whole screen.
+//
+//-------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "memory.h"
+#include "ports.h"
+#include "script.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+enum StepKind { Expect, Type, Wait };
+
+struct Step
+{
+	StepKind	kind;
+	string		text;
+	uint64_t	cycles;		// For Wait, and the timeout for Expect
+	int			line;		// In the script, for messages
+};
+
+static vector<Step> steps;
+static size_t current = 0;
+static bool started = false;		// Has the current step begun?
+static uint64_t startCycles;
+
+// Every line counts as changed to begin with, so the first expect can
+// match something that's already there
+
+static uint16_t changed = 0xffff;
+
+
+//-------------------------------------------------------------------------
+//
+// Parsing.
+//
+//-------------------------------------------------------------------------
+
+static string unescape(string text)
+{
+	if (text.size() >= 2 && text.front() == '"' && text.back() == '"')
+		text = text.substr(1, text.size() - 2);
+
+	string out;
+
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		if (text[i] != '\\' || i + 1 == text.size())
+		{
+			out += text[i];
+			continue;
+		}
+
+		switch (text[++i])
+		{
+		case 'n':	out += '\n'; break;
+		case 'r':	out += '\r'; break;
+		case 't':	out += '\t'; break;
+		default:	out += text[i]; break;
+		}
+	}
+
+	return out;
+}
+
+void loadScript(const string &filename)
+{
+	ifstream f(filename, std::fstream::in);
+	if (!f.is_open())
+	{
+		cerr << "Cannot open " << filename << endl;
+		exit(1);
+	}
+
+	uint64_t timeout = 100000000;
+	string line;
+	int number = 0;
+
+	while (getline(f, line))
+	{
+		++number;
+
+		size_t start = line.find_first_not_of(" \t");
+		if (start == string::npos || line[start] == '#')
+			continue;
+
+		size_t end = line.find_first_of(" \t", start);
+		string command = line.substr(start, end - start);
+
+		string arg;
+		if (end != string::npos && (end = line.find_first_not_of(" \t", end)) != string::npos)
+			arg = line.substr(end);
+
+		while (!arg.empty() && (arg.back() == '\r' || arg.back() == ' ' || arg.back() == '\t'))
+			arg.pop_back();
+
+		if (command == "expect" && !arg.empty())
+			steps.push_back({ Expect, unescape(arg), timeout, number });
+		else if (command == "type" && !arg.empty())
+			steps.push_back({ Type, unescape(arg), 0, number });
+		else if (command == "wait" && !arg.empty())
+			steps.push_back({ Wait, "", strtoull(arg.c_str(), nullptr, 0), number });
+		else if (command == "timeout" && !arg.empty())
+			timeout = strtoull(arg.c_str(), nullptr, 0);
+		else
+		{
+			cerr << filename << ":" << number << ": can't understand " << line << endl;
+			exit(1);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run the current step, moving on to the next when it's done.
+//
+//-------------------------------------------------------------------------
+
+ScriptStatus scriptPoll(uint16_t changedLines)
+{
+	changed |= changedLines;
+
+	while (current < steps.size())
+	{
+		const Step &step = steps[current];
+		uint64_t now = z80cycles();
+
+		if (!started)
+		{
+			started = true;
+			startCycles = now;
+
+			if (step.kind == Type)
+				typeKeys(step.text);
+		}
+
+		switch (step.kind)
+		{
+		case Expect:
+			if (changed && findOnScreen(step.text, changed))
+			{
+				changed = 0;
+				break;
+			}
+
+			if (now - startCycles >= step.cycles)
+			{
+				cerr << "Script line " << step.line << ": timed out waiting for \""
+					 << step.text << "\"" << endl;
+				return ScriptFailed;
+			}
+
+			changed = 0;		// These lines have been looked at
+			return ScriptRunning;
+
+		case Type:
+			if (keysPending())
+				return ScriptRunning;
+			break;
+
+		case Wait:
+			if (now - startCycles < step.cycles)
+				return ScriptRunning;
+			break;
+		}
+
+		++current;
+		started = false;
+	}
+
+	return ScriptDone;
+}
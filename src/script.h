@@ -0,0 +1,29 @@
+//-------------------------------------------------------------------------
+//
+// Expect-style scripts for driving the machine, see script.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+#include <string>
+
+enum ScriptStatus
+{
+	ScriptRunning,
+	ScriptDone,
+	ScriptFailed,		// Timed out waiting for the screen
+};
+
+// Read a script, exits if it can't be parsed
+
+void loadScript(const std::string &filename);
+
+// Move the script on, called between instructions with the screen lines
+// that changed during the last one
+
+ScriptStatus scriptPoll(uint16_t changedLines);
+
+#endif
@@ -0,0 +1,614 @@
+//-------------------------------------------------------------------------
+//
+// Run lots of NASCOMs in one process, one per connection.
+//
+//   nascom-server [-s socket] [-t count] [-n cycles] [-j threads] [-f MHz]
+//                 [-v prefix]
+//
+// Each session connects to the Unix domain socket, or is given one of
+// count ptys up front (their names are printed at startup). Whatever the
+// session sends is typed on its machine's keyboard, and the machine's
+// screen comes back as ANSI escapes, only the lines that changed.
+//
+// The machines are run a slice of cycles at a time on a pool of worker
+// threads, one per core unless -j says otherwise. Each worker has its own
+// queue of machines and takes from the others when it runs dry, so one
+// busy worker doesn't hold the rest up. Machines are kept to MHz (0 is
+// flat out), and a machine that spends whole slices in NAS-SYS waiting
+// for a key is parked until its session sends something.
+//
+// With -v each machine publishes its screen and registers after every
+// slice, in the shared memory /prefix-n for the nth session (see view.cpp).
+//
+// The emulator core, memory, keyboard and events all keep one machine in
+// globals.
+// This is built with NASCOM_THREADS so those are per thread instead, and a
+// worker loads a machine into them before running it and saves it
+// afterwards.
+//
+//-------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <queue>
+#include <signal.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "events.h"
+#include "memory.h"
+#include "ports.h"
+#include "view.h"
+#include "z80-simulator.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+
+static uint64_t sliceCycles = 100000;
+static double mhz = 4;
+static string viewPrefix;
+static int sessionCount = 0;
+
+// NAS-SYS lives below here. A machine that doesn't leave it for a few
+// slices in a row, with nothing left to type, is waiting for a key.
+
+const uint16_t MonitorEnd = 0x0800;
+const int IdleSlices = 4;
+
+struct Machine
+{
+	Z80Registers	regs;
+	uint64_t		cycles = 0;
+	uint8_t			*ram;
+	Keyboard		*keyboard;
+	EventQueue		*events;
+	View			*view = nullptr;
+
+	int				fd;
+	bool			redraw = true;			// Send the whole screen next time
+	int				idle = 0;				// Slices spent waiting for a key
+	Clock::time_point due;					// For pacing
+
+	mutex			lock;					// Guards the rest
+	string			input;					// Received, not typed yet
+	bool			parked = false;
+	bool			closed = false;
+
+	Machine(int fd) : ram(newMemory()), keyboard(newKeyboard()),
+		events(newEventQueue()), fd(fd), due(Clock::now())
+	{
+		z80reset();
+		z80getRegisters(regs);
+	}
+
+	~Machine()
+	{
+		deleteMemory(ram);
+		deleteKeyboard(keyboard);
+		deleteEventQueue(events);
+		closeView(view);
+		close(fd);
+	}
+};
+
+
+//-------------------------------------------------------------------------
+//
+// The worker queues. The owner takes from the front and puts back at the
+// back, so its machines take turns, and thieves take from the back.
+//
+//-------------------------------------------------------------------------
+
+struct WorkQueue
+{
+	mutex				lock;
+	deque<Machine *>	machines;
+};
+
+static vector<WorkQueue> queues;
+static atomic<int> queued(0);
+static atomic<unsigned> nextQueue(0);
+
+static mutex idleLock;
+static condition_variable wakeUp;
+
+static void schedule(Machine *m, int worker = -1)
+{
+	if (worker < 0)
+		worker = nextQueue++ % queues.size();
+
+	{
+		lock_guard<mutex> g(queues[worker].lock);
+		queues[worker].machines.push_back(m);
+	}
+
+	++queued;
+	lock_guard<mutex> g(idleLock);
+	wakeUp.notify_one();
+}
+
+static Machine *takeWork(int worker)
+{
+	size_t count = queues.size();
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		WorkQueue &q = queues[(worker + i) % count];
+		lock_guard<mutex> g(q.lock);
+
+		if (q.machines.empty())
+			continue;
+
+		Machine *m;
+		if (i == 0)
+		{
+			m = q.machines.front();
+			q.machines.pop_front();
+		}
+		else
+		{
+			m = q.machines.back();
+			q.machines.pop_back();
+		}
+
+		--queued;
+		return m;
+	}
+
+	return nullptr;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Pacing. Machines that are ahead of the clock wait here until they're
+// due again.
+//
+//-------------------------------------------------------------------------
+
+struct Waiting
+{
+	Clock::time_point	due;
+	Machine				*machine;
+
+	bool operator>(const Waiting &other) const { return due > other.due; }
+};
+
+static priority_queue<Waiting, vector<Waiting>, greater<Waiting>> waiting;
+static mutex timerLock;
+static condition_variable timerWake;
+
+static void waitUntilDue(Machine *m)
+{
+	lock_guard<mutex> g(timerLock);
+
+	bool first = waiting.empty() || m->due < waiting.top().due;
+	waiting.push({ m->due, m });
+
+	if (first)
+		timerWake.notify_one();
+}
+
+static void timerThread()
+{
+	unique_lock<mutex> g(timerLock);
+
+	while (1)
+	{
+		if (waiting.empty())
+		{
+			timerWake.wait(g);
+			continue;
+		}
+
+		Clock::time_point due = waiting.top().due;
+		if (Clock::now() < due)
+		{
+			timerWake.wait_until(g, due);
+			continue;
+		}
+
+		Machine *m = waiting.top().machine;
+		waiting.pop();
+
+		g.unlock();
+		schedule(m);
+		g.lock();
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Send the screen lines that changed. If the session can't keep up the
+// output is dropped and it gets the whole screen later.
+//
+//-------------------------------------------------------------------------
+
+static void sendScreen(Machine *m, uint16_t lines)
+{
+	string out;
+
+	if (m->redraw)
+	{
+		out = "\033[2J";
+		lines = 0xffff;
+		m->redraw = false;
+	}
+
+	for (int line = 0; lines; ++line, lines >>= 1)
+	{
+		if (!(lines & 1))
+			continue;
+
+		// Line 15 is displayed at the top, see updateScreen()
+
+		out += "\033[" + to_string(line == 15 ? 1 : line + 2) + ";1H" + screenLine(line);
+	}
+
+	if (out.empty())
+		return;
+
+	ssize_t sent = write(m->fd, out.data(), out.size());
+	if (sent != (ssize_t) out.size())
+		m->redraw = true;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Run a machine for one slice.
+//
+//-------------------------------------------------------------------------
+
+static void runSlice(Machine *m)
+{
+	string text;
+	{
+		lock_guard<mutex> g(m->lock);
+		text.swap(m->input);
+	}
+
+	useMemory(m->ram);
+	useKeyboard(m->keyboard);
+	useEventQueue(m->events);
+	z80setRegisters(m->regs);
+	z80setCycles(m->cycles);
+	takeDirtyLines();
+
+	replace(text.begin(), text.end(), '\r', '\n');
+	typeKeys(text);
+
+	uint64_t end = m->cycles + sliceCycles;
+	bool busy = !text.empty();
+
+	while (z80cycles() < end)
+	{
+		runEvents();
+		uint64_t stop = min(end, nextEvent());
+
+		while (z80cycles() < stop)
+		{
+			if (z80pc() >= MonitorEnd)
+				busy = true;
+
+			z80step();
+		}
+	}
+
+	if (busy || keysPending())
+		m->idle = 0;
+	else
+		++m->idle;
+
+	sendScreen(m, takeDirtyLines());
+
+	if (m->view)
+		publishView(m->view);
+
+	z80getRegisters(m->regs);
+	m->cycles = z80cycles();
+}
+
+// Decide what happens to a machine after its slice
+
+static void reschedule(Machine *m, int worker)
+{
+	bool closed;
+	{
+		lock_guard<mutex> g(m->lock);
+		closed = m->closed;
+
+		if (!closed && m->idle >= IdleSlices && m->input.empty())
+		{
+			m->parked = true;
+			return;
+		}
+	}
+
+	if (closed)
+	{
+		delete m;
+		return;
+	}
+
+	if (mhz <= 0)
+	{
+		schedule(m, worker);
+		return;
+	}
+
+	// Don't try to catch up after falling behind (or being parked)
+
+	Clock::time_point now = Clock::now();
+	m->due += chrono::microseconds(uint64_t(sliceCycles / mhz));
+
+	if (m->due < now - chrono::milliseconds(100))
+		m->due = now;
+
+	waitUntilDue(m);
+}
+
+static void workerThread(int worker)
+{
+	while (1)
+	{
+		Machine *m = takeWork(worker);
+
+		if (!m)
+		{
+			unique_lock<mutex> g(idleLock);
+			wakeUp.wait(g, [] { return queued > 0; });
+			continue;
+		}
+
+		bool closed;
+		{
+			lock_guard<mutex> g(m->lock);
+			closed = m->closed;
+		}
+
+		if (closed)
+			delete m;
+		else
+		{
+			runSlice(m);
+			reschedule(m, worker);
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Sessions. The main thread does all the reading and hands the input to
+// the machines, waking them if they're parked. Only a worker ever deletes
+// a machine, so a session that goes away is just marked closed.
+//
+//-------------------------------------------------------------------------
+
+static void deliver(Machine *m, const char *data, size_t length)
+{
+	lock_guard<mutex> g(m->lock);
+
+	if (data)
+		m->input.append(data, length);
+	else
+		m->closed = true;
+
+	if (m->parked)
+	{
+		m->parked = false;
+		m->idle = 0;
+		schedule(m);
+	}
+}
+
+static int openListener(const string &path)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	unlink(path.c_str());
+
+	if (fd < 0 || bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0)
+	{
+		cerr << "Cannot listen on " << path << endl;
+		exit(1);
+	}
+
+	return fd;
+}
+
+// Returns the master side. The slave is left open so the master doesn't
+// see a hangup between sessions.
+
+static int openPty()
+{
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+	{
+		cerr << "Cannot open a pty" << endl;
+		exit(1);
+	}
+
+	const char *name = ptsname(master);
+	int slave = open(name, O_RDWR | O_NOCTTY);
+
+	termios settings;
+	tcgetattr(slave, &settings);
+	cfmakeraw(&settings);
+	tcsetattr(slave, TCSANOW, &settings);
+
+	cout << name << endl;
+	return master;
+}
+
+static Machine *newMachine(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	Machine *m = new Machine(fd);
+	++sessionCount;
+
+	if (!viewPrefix.empty())
+		m->view = openView("/" + viewPrefix + "-" + to_string(sessionCount));
+
+	schedule(m);
+	return m;
+}
+
+static void serve(int listener, vector<Machine *> sessions)
+{
+	vector<pollfd> fds;
+
+	while (1)
+	{
+		fds.clear();
+		if (listener >= 0)
+			fds.push_back({ listener, POLLIN, 0 });
+		for (Machine *m : sessions)
+			fds.push_back({ m->fd, POLLIN, 0 });
+
+		if (poll(fds.data(), fds.size(), -1) < 0)
+			continue;
+
+		size_t first = 0;
+		if (listener >= 0)
+		{
+			if (fds[0].revents & POLLIN)
+			{
+				int fd = accept(listener, nullptr, nullptr);
+				if (fd >= 0)
+					sessions.push_back(newMachine(fd));
+			}
+			first = 1;
+		}
+
+		// Go backwards so closed sessions can be taken out as we go
+
+		for (size_t i = fds.size(); i-- > first; )
+		{
+			if (!fds[i].revents)
+				continue;
+
+			Machine *m = sessions[i - first];
+			char buffer[256];
+			ssize_t n = read(fds[i].fd, buffer, sizeof(buffer));
+
+			if (n > 0)
+				deliver(m, buffer, n);
+			else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			{
+				sessions.erase(sessions.begin() + (i - first));
+				deliver(m, nullptr, 0);
+			}
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Start up.
+//
+//-------------------------------------------------------------------------
+
+static void usage()
+{
+	cerr << "Usage: nascom-server [-s socket] [-t count] [-n cycles] [-j threads] [-f MHz]" << endl;
+	cerr << "                     [-v prefix]" << endl;
+	cerr << "  -s socket   accept sessions on a Unix domain socket" << endl;
+	cerr << "  -t count    open count ptys, one machine on each" << endl;
+	cerr << "  -n cycles   T-states per time slice (default 100000)" << endl;
+	cerr << "  -j threads  worker threads (default one per core)" << endl;
+	cerr << "  -f MHz      clock speed, 0 for flat out (default 4)" << endl;
+	cerr << "  -v prefix   publish each machine in the shared memory /prefix-n" << endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	string socketPath;
+	int ptys = 0;
+	unsigned threads = thread::hardware_concurrency();
+	int c;
+
+	while ((c = getopt(argc, argv, "s:t:n:j:f:v:")) != -1)
+	{
+		switch (c)
+		{
+		case 's':
+			socketPath = optarg;
+			break;
+		case 't':
+			ptys = atoi(optarg);
+			break;
+		case 'n':
+			sliceCycles = strtoull(optarg, nullptr, 0);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'f':
+			mhz = atof(optarg);
+			break;
+		case 'v':
+			viewPrefix = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if ((socketPath.empty() && ptys <= 0) || sliceCycles == 0)
+		usage();
+
+	if (threads == 0)
+		threads = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	// Load everything once. The machines share the ROMs and each starts
+	// with a copy of the RAM.
+
+	loadNasFile("nassys3.nal");
+	loadNasFile("nastest.nal");
+	loadNasFile("basic.nal");
+	shareRoms();
+
+	setHeadless();
+
+	queues = vector<WorkQueue>(threads);
+
+	vector<Machine *> sessions;
+	for (int i = 0; i < ptys; ++i)
+		sessions.push_back(newMachine(openPty()));
+
+	int listener = socketPath.empty() ? -1 : openListener(socketPath);
+
+	thread(timerThread).detach();
+	for (unsigned i = 0; i < threads; ++i)
+		thread(workerThread, i).detach();
+
+	serve(listener, sessions);
+}
@@ -0,0 +1,286 @@
+//-------------------------------------------------------------------------
+//
+// Run one machine code program on many machines that differ only in their
+// input, using the experimental lockstep engine.
+//
+//   nascom-sweep [-a addr] [-g start] [-e stop] [-n cycles] [-d addr,len] [-c]
+//                program.nal value...
+//
+// Each value gets its own machine, with the value stored as a word at addr
+// (default C80). The program starts at start (default the first address
+// it loads at) with SP at E000, and runs until PC reaches stop or for
+// cycles T-states (default 10M). Each machine's registers are printed
+// afterwards, and len bytes of memory from addr if -d is given.
+//
+// -c runs every machine again through the plain z80step() loop, checks the
+// results are the same and compares the times.
+//
+//-------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "lockstep.h"
+#include "memory.h"
+#include "z80-simulator.h"
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+
+struct Machine
+{
+	uint16_t		input;
+	uint8_t			*memory;
+	Z80Registers	regs;
+	uint64_t		cycles;
+};
+
+static uint16_t inputAddr = 0x0c80;
+static int stopAt = -1;
+static uint64_t cycleLimit = 10000000;
+
+
+//-------------------------------------------------------------------------
+//
+// Set up a machine for each value.
+//
+//-------------------------------------------------------------------------
+
+static vector<Machine> makeMachines(const vector<uint16_t> &inputs, uint16_t start)
+{
+	vector<Machine> machines;
+
+	for (uint16_t input : inputs)
+	{
+		Machine m = { input, newMemory(), {}, 0 };
+
+		m.memory[inputAddr] = input & 0xff;
+		m.memory[(uint16_t) (inputAddr + 1)] = input >> 8;
+
+		m.regs.pc = start;
+		m.regs.sp = 0xe000;
+
+		machines.push_back(m);
+	}
+
+	return machines;
+}
+
+static void freeMachines(vector<Machine> &machines)
+{
+	for (Machine &m : machines)
+		deleteMemory(m.memory);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The two ways of running them.
+//
+//-------------------------------------------------------------------------
+
+static double runLockstep(vector<Machine> &machines)
+{
+	auto start = Clock::now();
+
+	for (size_t group = 0; group < machines.size(); group += LockstepLanes)
+	{
+		lockstepClear();
+
+		size_t count = min(machines.size() - group, (size_t) LockstepLanes);
+		for (size_t lane = 0; lane < count; ++lane)
+		{
+			Machine &m = machines[group + lane];
+			lockstepLoad(lane, m.regs, m.cycles, m.memory);
+		}
+
+		lockstepRun(cycleLimit, stopAt);
+
+		for (size_t lane = 0; lane < count; ++lane)
+		{
+			Machine &m = machines[group + lane];
+			lockstepSave(lane, m.regs, m.cycles);
+		}
+	}
+
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double runScalar(vector<Machine> &machines)
+{
+	auto start = Clock::now();
+
+	for (Machine &m : machines)
+	{
+		useMemory(m.memory);
+		z80setRegisters(m.regs);
+		z80setCycles(m.cycles);
+
+		uint64_t end = m.cycles + cycleLimit;
+		while (z80cycles() < end && z80pc() != stopAt)
+			z80step();
+
+		z80getRegisters(m.regs);
+		m.cycles = z80cycles();
+	}
+
+	return chrono::duration<double>(Clock::now() - start).count();
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Output.
+//
+//-------------------------------------------------------------------------
+
+static void show(const Machine &m, int dumpAddr, int dumpLength)
+{
+	const Z80Registers &r = m.regs;
+
+	printf("%04X: AF=%04X BC=%04X DE=%04X HL=%04X IX=%04X IY=%04X SP=%04X PC=%04X T=%llu",
+		m.input, r.af, r.bc, r.de, r.hl, r.ix, r.iy, r.sp, r.pc, (unsigned long long) m.cycles);
+
+	if (dumpLength > 0)
+	{
+		printf("  ");
+		for (int i = 0; i < dumpLength; ++i)
+			printf(" %02X", readMemory(m.memory, dumpAddr + i));
+	}
+
+	printf("\n");
+}
+
+static bool sameResult(const Machine &a, const Machine &b)
+{
+	const Z80Registers &x = a.regs;
+	const Z80Registers &y = b.regs;
+
+	if (x.af != y.af || x.bc != y.bc || x.de != y.de || x.hl != y.hl ||
+		x.ix != y.ix || x.iy != y.iy || x.sp != y.sp || x.pc != y.pc ||
+		x.afAlt != y.afAlt || x.bcAlt != y.bcAlt || x.deAlt != y.deAlt ||
+		x.hlAlt != y.hlAlt || a.cycles != b.cycles)
+		return false;
+
+	for (int addr = 0; addr < 64*1024; ++addr)
+		if (readMemory(a.memory, addr) != readMemory(b.memory, addr))
+			return false;
+
+	return true;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Start up.
+//
+//-------------------------------------------------------------------------
+
+static void usage()
+{
+	cerr << "Usage: nascom-sweep [-a addr] [-g start] [-e stop] [-n cycles] [-d addr,len] [-c]" << endl;
+	cerr << "                    program.nal value..." << endl;
+	cerr << "  -a addr      where each machine's value is stored (default C80)" << endl;
+	cerr << "  -g start     where the program starts (default where it loads)" << endl;
+	cerr << "  -e stop      stop when PC gets here" << endl;
+	cerr << "  -n cycles    T-states to run for (default 10M)" << endl;
+	cerr << "  -d addr,len  show len bytes from addr afterwards" << endl;
+	cerr << "  -c           run them all again without lockstep and compare" << endl;
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int start = -1;
+	int dumpAddr = 0, dumpLength = 0;
+	bool compare = false;
+	int c;
+
+	while ((c = getopt(argc, argv, "a:g:e:n:d:c")) != -1)
+	{
+		switch (c)
+		{
+		case 'a':
+			inputAddr = strtoul(optarg, nullptr, 16);
+			break;
+		case 'g':
+			start = strtoul(optarg, nullptr, 16);
+			break;
+		case 'e':
+			stopAt = strtoul(optarg, nullptr, 16);
+			break;
+		case 'n':
+			cycleLimit = strtoull(optarg, nullptr, 0);
+			break;
+		case 'd':
+			if (sscanf(optarg, "%x,%i", &dumpAddr, &dumpLength) != 2)
+				usage();
+			break;
+		case 'c':
+			compare = true;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc - optind < 2)
+		usage();
+
+	loadNasFile("nassys3.nal");
+	loadNasFile("basic.nal");
+	LoadedRange range = loadNasFile(argv[optind]);
+	shareRoms();
+	setHeadless();
+
+	if (start < 0)
+		start = range.first;
+
+	vector<uint16_t> inputs;
+	for (int i = optind + 1; i < argc; ++i)
+		inputs.push_back(strtoul(argv[i], nullptr, 16));
+
+	vector<Machine> machines = makeMachines(inputs, start);
+	double lockstepTime = runLockstep(machines);
+	LockstepStats stats = lockstepStats();
+
+	for (const Machine &m : machines)
+		show(m, dumpAddr, dumpLength);
+
+	if (!compare)
+	{
+		freeMachines(machines);
+		return 0;
+	}
+
+	vector<Machine> plain = makeMachines(inputs, start);
+	double scalarTime = runScalar(plain);
+
+	int mismatches = 0;
+	for (size_t i = 0; i < machines.size(); ++i)
+	{
+		if (!sameResult(machines[i], plain[i]))
+		{
+			cerr << "Different result for " << hex << machines[i].input << dec << ", plain run:" << endl;
+			show(plain[i], dumpAddr, dumpLength);
+			++mismatches;
+		}
+	}
+
+	fprintf(stderr, "lockstep %.3fs, plain %.3fs, %.2fx", lockstepTime, scalarTime,
+		lockstepTime > 0 ? scalarTime / lockstepTime : 0.0);
+	fprintf(stderr, " (last group: %llu steps over %llu lanes, %llu on their own)\n",
+		(unsigned long long) stats.vectorSteps, (unsigned long long) stats.vectorLanes,
+		(unsigned long long) stats.scalarSteps);
+
+	freeMachines(machines);
+	freeMachines(plain);
+
+	return mismatches ? 1 : 0;
+}
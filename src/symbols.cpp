@@ -0,0 +1,243 @@
+//-------------------------------------------------------------------------
+//
+// Symbol maps for the guest code. These are plain text label/address
+// files, for example extracted from the NAS-SYS listing in
+// http://www.nascomhomepage.com/mon/Nassys3.mac. Each line can be any of
+//
+//   KBD: EQU 0069H      KBD EQU $0069      KBD = 0x69
+//   KBD 0069            0069 KBD
+//
+// Anything after a ';' or '#' is a comment, and lines that don't look
+// like a symbol are skipped so that assembler output can be used as is.
+//
+//-------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "symbols.h"
+
+using namespace std;
+
+
+struct Symbol
+{
+	uint16_t	addr;
+	string		name;
+};
+
+static vector<Symbol> symbols;		// Sorted by address
+static vector<int>    nearest;		// Closest symbol for every address
+
+
+//-------------------------------------------------------------------------
+//
+// Parse a number in any of the usual assembler notations. When strict is
+// set the token must say it's a number (prefix, H suffix or leading
+// digit), otherwise plain hex digits are enough.
+//
+//-------------------------------------------------------------------------
+
+static bool parseNumber(string tok, uint16_t &val, bool strict)
+{
+	bool marked = false;
+
+	if (tok.size() > 2 && tok[0] == '0' && (tok[1] == 'x' || tok[1] == 'X'))
+	{
+		tok = tok.substr(2);
+		marked = true;
+	}
+	else if (tok.size() > 1 && (tok[0] == '$' || tok[0] == '#'))
+	{
+		tok = tok.substr(1);
+		marked = true;
+	}
+	else if (tok.size() > 1 && (tok.back() == 'h' || tok.back() == 'H'))
+	{
+		tok.pop_back();
+		marked = true;
+	}
+
+	if (tok.empty() || tok.size() > 5)
+		return false;
+
+	for (char c : tok)
+		if (!isxdigit((unsigned char) c))
+			return false;
+
+	if (strict && !marked && !isdigit((unsigned char) tok[0]))
+		return false;
+
+	unsigned long v = strtoul(tok.c_str(), nullptr, 16);
+	if (v > 0xffff)
+		return false;
+
+	val = v;
+	return true;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Work out the name and address from the tokens on one line.
+//
+//-------------------------------------------------------------------------
+
+static bool parseSymbol(vector<string> toks, Symbol &sym)
+{
+	if (!toks.empty() && toks[0].back() == ':')
+		toks[0].pop_back();
+
+	// NAME EQU value, NAME = value
+
+	if (toks.size() == 3)
+	{
+		string op = toks[1];
+		transform(op.begin(), op.end(), op.begin(), ::toupper);
+
+		if (op != "EQU" && op != "=")
+			return false;
+
+		sym.name = toks[0];
+		return parseNumber(toks[2], sym.addr, false);
+	}
+
+	if (toks.size() != 2)
+		return false;
+
+	// NAME value or value NAME. Prefer whichever is clearly a number,
+	// otherwise assume the name comes first.
+
+	uint16_t a, b;
+	bool strictA = parseNumber(toks[0], a, true);
+	bool strictB = parseNumber(toks[1], b, true);
+
+	if (strictA && !strictB)
+	{
+		sym.addr = a;
+		sym.name = toks[1];
+		return true;
+	}
+
+	if (parseNumber(toks[1], b, false))
+	{
+		sym.addr = b;
+		sym.name = toks[0];
+		return true;
+	}
+
+	if (parseNumber(toks[0], a, false))
+	{
+		sym.addr = a;
+		sym.name = toks[1];
+		return true;
+	}
+
+	return false;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Load a symbol file and rebuild the address lookup.
+//
+//-------------------------------------------------------------------------
+
+void loadSymbols(const string &filename)
+{
+	ifstream f(filename, std::fstream::in);
+	if (!f.is_open())
+	{
+		cerr << "Cannot open " << filename << endl;
+		exit(1);
+	}
+
+	string line;
+	while (getline(f, line))
+	{
+		line = line.substr(0, line.find_first_of(";#"));
+
+		istringstream words(line);
+		vector<string> toks;
+		string tok;
+
+		while (words >> tok)
+			toks.push_back(tok);
+
+		Symbol sym;
+		if (parseSymbol(toks, sym))
+			symbols.push_back(sym);
+	}
+
+	stable_sort(symbols.begin(), symbols.end(),
+		[](const Symbol &a, const Symbol &b) { return a.addr < b.addr; });
+
+	nearest.assign(64*1024, -1);
+
+	int index = -1;
+	size_t next = 0;
+
+	for (int addr = 0; addr < 64*1024; ++addr)
+	{
+		if (next < symbols.size() && symbols[next].addr == addr)
+		{
+			index = next;		// The first label at an address wins
+
+			while (next < symbols.size() && symbols[next].addr == addr)
+				++next;
+		}
+
+		nearest[addr] = index;
+	}
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Lookups.
+//
+//-------------------------------------------------------------------------
+
+int numSymbols()
+{
+	return symbols.size();
+}
+
+int symbolIndex(uint16_t addr)
+{
+	return nearest.empty() ? -1 : nearest[addr];
+}
+
+const string &symbolName(int index)
+{
+	return symbols[index].name;
+}
+
+uint16_t symbolAddress(int index)
+{
+	return symbols[index].addr;
+}
+
+bool findSymbol(const string &name, uint16_t &addr)
+{
+	for (const Symbol &sym : symbols)
+	{
+		if (sym.name == name)
+		{
+			addr = sym.addr;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool parseAddress(const string &text, uint16_t &addr)
+{
+	return findSymbol(text, addr) || parseNumber(text, addr, false);
+}
@@ -0,0 +1,39 @@
+//-------------------------------------------------------------------------
+//
+// Symbol maps for the guest code, see symbols.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdint.h>
+#include <string>
+
+// Add the labels from a symbol file, can be called for several files
+
+void loadSymbols(const std::string &filename);
+
+// How many symbols are loaded
+
+int numSymbols();
+
+// Index of the closest symbol at or below addr, or -1 if there isn't one
+
+int symbolIndex(uint16_t addr);
+
+// Name and address of a symbol index
+
+const std::string &symbolName(int index);
+uint16_t symbolAddress(int index);
+
+// Find a symbol by name
+
+bool findSymbol(const std::string &name, uint16_t &addr);
+
+// An address typed by the user, either a symbol name or a number in any of
+// the notations the symbol files use (plain digits are hex)
+
+bool parseAddress(const std::string &text, uint16_t &addr);
+
+#endif
@@ -0,0 +1,193 @@
+//-------------------------------------------------------------------------
+//
+// Binary execution trace. Every instruction (PC, the bytes there and the
+// main registers) and every memory write goes into a fixed ring buffer of
+// small records, so that tracing is cheap enough to leave on. Nothing is
+// formatted until the ring is dumped, nastrace turns a dump back into
+// something readable.
+//
+// traceStep() wraps z80step() in the same way as profileStep().
+//
+//-------------------------------------------------------------------------
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "memory.h"
+#include "trace.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+static vector<TraceRecord> ring;
+static size_t mask;
+static size_t head;			// Total records written so far
+
+static string dumpFile;
+
+static volatile sig_atomic_t dumpRequested = 0;
+
+
+//-------------------------------------------------------------------------
+//
+// Add the records.
+//
+//-------------------------------------------------------------------------
+
+void traceStep()
+{
+	// Waiting at a HALT doesn't run anything, the HALT has its record
+
+	if (!z80halted())
+	{
+		Z80Registers regs;
+		z80getRegisters(regs);
+
+		TraceRecord &r = ring[head++ & mask];
+
+		r.kind = TraceInstruction;
+		r.value = 0;
+		r.addr = regs.pc;
+		for (int i = 0; i < 4; ++i)
+			r.bytes[i] = readRam(regs.pc + i);
+		r.af = regs.af;
+		r.bc = regs.bc;
+		r.de = regs.de;
+		r.hl = regs.hl;
+		r.sp = regs.sp;
+		r.ix = regs.ix;
+		r.iy = regs.iy;
+		r.ticks = z80cycles();
+	}
+
+	z80step();
+
+	if (dumpRequested)
+	{
+		dumpRequested = 0;
+		dumpTrace();
+	}
+}
+
+static void traceWrite(uint16_t addr, uint8_t val)
+{
+	TraceRecord &r = ring[head++ & mask];
+
+	memset(&r, 0, sizeof(r));
+	r.kind = TraceWrite;
+	r.value = val;
+	r.addr = addr;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Write the ring out, oldest record first. This gets called from signal
+// handlers, so it sticks to plain system calls.
+//
+//-------------------------------------------------------------------------
+
+static void writeAll(int fd, const void *data, size_t size)
+{
+	const char *p = static_cast<const char *>(data);
+
+	while (size > 0)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n <= 0)
+			return;
+
+		p += n;
+		size -= n;
+	}
+}
+
+void dumpTrace()
+{
+	int fd = open(dumpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+
+	size_t count = (head < ring.size()) ? head : ring.size();
+	size_t first = (head - count) & mask;
+
+	TraceHeader header;
+	memcpy(header.magic, TraceMagic, sizeof(header.magic));
+	header.version = TraceVersion;
+	header.recordSize = sizeof(TraceRecord);
+	header.count = count;
+
+	writeAll(fd, &header, sizeof(header));
+
+	// The oldest records are at the end of the ring once it has wrapped
+
+	size_t tail = ring.size() - first;
+	if (tail > count)
+		tail = count;
+
+	writeAll(fd, &ring[first], tail * sizeof(TraceRecord));
+	writeAll(fd, &ring[0], (count - tail) * sizeof(TraceRecord));
+
+	close(fd);
+}
+
+
+//-------------------------------------------------------------------------
+//
+// SIGUSR2 asks for a dump between instructions. A crash or a fatal signal
+// dumps straight away, then lets the signal carry on as normal.
+//
+//-------------------------------------------------------------------------
+
+static void onDumpSignal(int sig)
+{
+	dumpRequested = 1;
+}
+
+static void onFatalSignal(int sig)
+{
+	dumpTrace();
+	raise(sig);		// The handler was reset, so this is the default action
+}
+
+static void dumpAtExit()
+{
+	dumpTrace();
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Allocate the ring and install the hooks.
+//
+//-------------------------------------------------------------------------
+
+void startTrace(const string &filename, size_t records)
+{
+	size_t size = 1;
+	while (size < records)
+		size <<= 1;
+
+	ring.assign(size, TraceRecord());
+	mask = size - 1;
+	head = 0;
+	dumpFile = filename;
+
+	hookWrites(traceWrite);
+
+	struct sigaction sa = {};
+	sa.sa_handler = onDumpSignal;
+	sigaction(SIGUSR2, &sa, nullptr);
+
+	sa.sa_handler = onFatalSignal;
+	sa.sa_flags = SA_RESETHAND;
+	for (int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, SIGINT, SIGTERM })
+		sigaction(sig, &sa, nullptr);
+
+	atexit(dumpAtExit);
+}
@@ -0,0 +1,59 @@
+//-------------------------------------------------------------------------
+//
+// Binary execution trace, see trace.cpp. The file format is shared with
+// the nastrace decoder.
+//
+//-------------------------------------------------------------------------
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+enum TraceKind : uint8_t
+{
+	TraceInstruction = 1,	// About to execute the instruction at addr
+	TraceWrite		 = 2,	// The instruction wrote value to addr
+};
+
+struct TraceRecord
+{
+	uint8_t  kind;
+	uint8_t  value;			// Value written, for TraceWrite
+	uint16_t addr;			// PC, or the address written
+	uint8_t  bytes[4];		// Memory at the PC
+	uint16_t af, bc, de, hl;
+	uint16_t sp, ix, iy;
+	uint16_t ticks;			// Low 16 bits of the T-state count
+};
+
+// A dump is this header followed by the records, oldest first
+
+const char     TraceMagic[8] = { 'N', 'A', 'S', 'T', 'R', 'A', 'C', 'E' };
+const uint32_t TraceVersion  = 1;
+
+struct TraceHeader
+{
+	char	 magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint64_t count;
+};
+
+// Start tracing into a ring of the given number of records (rounded up to
+// a power of two). The ring is dumped to filename on exit, on a crash or
+// fatal signal, and whenever SIGUSR2 is received.
+
+void startTrace(const std::string &filename, size_t records);
+
+// Drop-in replacement for z80step() which records the instruction
+
+void traceStep();
+
+// Write the ring to the dump file now
+
+void dumpTrace();
+
+#endif
@@ -0,0 +1,115 @@
+//-------------------------------------------------------------------------
+//
+// Publish a machine's screen and registers through shared memory, for
+// viewers and dashboards to watch without the emulator drawing anything
+// for them. The emulator writes a frame at its frame boundaries (every
+// slice in the server) and any number of readers map the segment
+// read-only. A sequence count makes it a seqlock: the writer never waits
+// for the readers, and a reader that catches a frame half written just
+// copies it again (see readView() in view.h).
+//
+//-------------------------------------------------------------------------
+
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "view.h"
+#include "z80-simulator.h"
+
+using namespace std;
+
+
+struct View
+{
+	string		name;
+	ViewSegment	*segment;
+};
+
+
+//-------------------------------------------------------------------------
+//
+// Make the segment, and take it away again.
+//
+//-------------------------------------------------------------------------
+
+View *openView(const string &name)
+{
+	int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd < 0 || ftruncate(fd, sizeof(ViewSegment)) < 0)
+	{
+		cerr << "Cannot make the shared memory " << name << endl;
+		exit(1);
+	}
+
+	void *region = mmap(nullptr, sizeof(ViewSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (region == MAP_FAILED)
+	{
+		cerr << "Cannot map the shared memory " << name << endl;
+		exit(1);
+	}
+
+	ViewSegment *segment = new (region) ViewSegment;
+
+	memcpy(segment->magic, ViewMagic, sizeof(ViewMagic));
+	segment->version = ViewVersion;
+	segment->size = sizeof(ViewSegment);
+	memset((void *) &segment->latest, 0, sizeof(ViewFrame));
+	segment->sequence.store(0, memory_order_release);
+
+	return new View { name, segment };
+}
+
+void closeView(View *v)
+{
+	if (!v)
+		return;
+
+	munmap(v->segment, sizeof(ViewSegment));
+	shm_unlink(v->name.c_str());
+	delete v;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Write a frame. The frame is put together first so the segment is only
+// odd for the one copy.
+//
+//-------------------------------------------------------------------------
+
+void publishView(View *v)
+{
+	ViewSegment *segment = v->segment;
+
+	Z80Registers regs;
+	z80getRegisters(regs);
+
+	ViewFrame frame;
+	frame.frame = segment->latest.frame + 1;
+	frame.cycles = z80cycles();
+	frame.af = regs.af;
+	frame.bc = regs.bc;
+	frame.de = regs.de;
+	frame.hl = regs.hl;
+	frame.ix = regs.ix;
+	frame.iy = regs.iy;
+	frame.sp = regs.sp;
+	frame.pc = regs.pc;
+	memcpy(frame.video, currentMemory() + 0x800, sizeof(frame.video));
+
+	uint64_t sequence = segment->sequence.load(memory_order_relaxed);
+
+	segment->sequence.store(sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy((void *) &segment->latest, &frame, sizeof(frame));
+
+	segment->sequence.store(sequence + 2, memory_order_release);
+}
@@ -0,0 +1,71 @@
+//-------------------------------------------------------------------------
+//
+// Shared-memory view of a running machine, see view.cpp. The layout is
+// shared with readers such as nasview.
+//
+//-------------------------------------------------------------------------
+
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+const char     ViewMagic[8] = { 'N', 'A', 'S', 'V', 'I', 'E', 'W', 'S' };
+const uint32_t ViewVersion  = 1;
+
+// One frame of the machine
+
+struct ViewFrame
+{
+	uint64_t	frame;				// Frames published so far
+	uint64_t	cycles;				// T-states since reset
+	uint16_t	af, bc, de, hl;
+	uint16_t	ix, iy, sp, pc;
+	uint8_t		video[1024];		// Memory from 0800, the screen starts at 080A
+};
+
+// The segment. sequence is odd while the frame is being written, and goes
+// up by two each time, so readers never hold the writer up. They copy the
+// frame between two reads of sequence, and try again if those differ.
+
+struct ViewSegment
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	size;				// sizeof(ViewSegment)
+
+	std::atomic<uint64_t> sequence;
+	ViewFrame	latest;
+};
+
+// Create the shared memory object name (starting with '/') for the
+// current machine, and take it away again
+
+struct View;
+
+View *openView(const std::string &name);
+void closeView(View *v);
+
+// Copy the current machine into the segment as the next frame
+
+void publishView(View *v);
+
+// For readers: copy the latest frame. Returns false if the writer was in
+// the middle of one, the caller just tries again.
+
+inline bool readView(const ViewSegment *segment, ViewFrame &frame)
+{
+	uint64_t before = segment->sequence.load(std::memory_order_acquire);
+	if (before & 1)
+		return false;
+
+	memcpy(&frame, (const void *) &segment->latest, sizeof(frame));
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return segment->sequence.load(std::memory_order_relaxed) == before;
+}
+
+#endif
@@ -6,51 +6,72 @@
 //
 //-------------------------------------------------------------------------
 
-#include <stdint.h>
+#include <array>
+#include <utility>
 
-// The caller needs to supply these functions
+#include "z80-simulator.h"
 
-extern "C" uint8_t readRam(uint16_t addr);
-extern "C" void    writeRam(uint16_t addr, uint8_t val);
-extern "C" uint8_t portIn(uint8_t port);
-extern "C" void    portOut(uint8_t port, uint8_t val);
+// All the registers of the Z80. Each pair can be used whole or as its two
+// halves, with the halves in host byte order so neither needs a shift or
+// a mask. The ones nearly every instruction touches come first and the
+// whole file fits in one cache line.
 
-// All the registers of the Z80
+union RegisterPair
+{
+	uint16_t	word;
+	struct
+	{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		uint8_t	high;
+		uint8_t	low;
+#else
+		uint8_t	low;
+		uint8_t	high;
+#endif
+	};
+};
 
-static uint16_t AF;		// Accumulator and flags ?? Separate
-static uint16_t BC;		// Rename lower case ?? aReg, flags, bcReg
-static uint16_t DE;
-static uint16_t HL;
-static uint16_t ir;
-static uint16_t ix;
-static uint16_t iy;
-static uint16_t SP;
-static uint16_t PC;
-static uint16_t IFF;
+struct alignas(64) RegisterFile
+{
+	RegisterPair	af;				// A is high, F low
+	RegisterPair	bc;
+	RegisterPair	de;
+	RegisterPair	hl;
+	uint16_t		sp;
+	uint16_t		pc;
+	RegisterPair	ix;
+	RegisterPair	iy;
+	RegisterPair	ir;				// I is high, R low
+	uint16_t		iff;
+	uint8_t			im;				// Interrupt mode
 
-static uint16_t AFalt;	// Alternate registers
-static uint16_t BCalt;
-static uint16_t DEalt;
-static uint16_t HLalt;
+	RegisterPair	afAlt;			// Alternate registers
+	RegisterPair	bcAlt;
+	RegisterPair	deAlt;
+	RegisterPair	hlAlt;
+};
 
-inline uint8_t lowDigit(uint8_t val)	{ return val & 0x0f; }
-inline uint8_t highDigit(uint8_t val)	{ return (val >> 4) & 0x0f; }
-inline uint8_t lowReg(uint16_t val)		{ return val & 0x00ff; }
-inline uint8_t highReg(uint16_t val)	{ return (val >> 8) & 0x00ff; }
+static machine_local RegisterFile reg;
 
-#define SetlowReg(x, v)	x = (((x)&0xff00) | ((v)&0xff))
-#define SethighReg(x, v) x = (((x)&0xff) | (((v)&0xff) << 8))
+static machine_local uint64_t cycles;	// T-states executed since reset
 
-/*??
-union {
-	struct
-	{
-		uint8_t low;
-		uint8_t high;
-	}
-	uint16_t AF;
-} reg;
-*/
+// Anything that has to be looked at between instructions sets a bit here,
+// so when there's nothing to do z80step() only has the one test to make
+
+enum PendingBits : uint8_t
+{
+	IntRequest	= 1,			// raiseInt() until the interrupt is taken
+	NmiRequest	= 2,
+	Halted		= 4,			// Parked at a HALT until an interrupt
+	AfterEI		= 8,			// No interrupt straight after EI
+};
+
+static machine_local uint8_t pending;
+static machine_local uint8_t intVector;	// What the device put on the bus
+static machine_local uint64_t interrupts;	// Taken since reset
+
+inline uint8_t lowDigit(uint8_t val)	{ return val & 0x0f; }
+inline uint8_t highDigit(uint8_t val)	{ return (val >> 4) & 0x0f; }
 
 //-------------------------------------------------------------------------
 // Flag handling
@@ -66,14 +87,291 @@ const uint8_t SignFlag		= 0x80;
 inline void setFlag(uint8_t flag, bool val)
 {
 	if (val)
-		AF |= flag;
+		reg.af.low |= flag;
 	else
-		AF & ~flag;
+		reg.af.low &= ~flag;
+}
+
+
+//-------------------------------------------------------------------------
+// Lazy flags
+//
+// Most flag results are overwritten before anything looks at them, so the
+// 8-bit arithmetic only notes its operands, result and kind of operation,
+// and F is worked out when something reads it. While a result is pending
+// the low byte of AF is stale: testFlag() can answer for carry and zero
+// straight from the pending result, anything else that reads or keeps
+// part of F calls resolveFlags() first. Build with EAGER_FLAGS to work F
+// out after every operation, as yaze does.
+//-------------------------------------------------------------------------
+
+enum FlagOp : uint8_t
+{
+	FlagsKnown,				// F in AF is up to date
+	FlagsAdd,
+	FlagsSub,
+	FlagsCompare,
+	FlagsAnd,
+	FlagsLogic,				// XOR and OR
+	FlagsInc,
+	FlagsDec,
+};
+
+static machine_local uint8_t flagOp = FlagsKnown;
+static machine_local unsigned flagAcu;		// A before the operation
+static machine_local unsigned flagOperand;	// The other operand, or the carry INC/DEC keep
+static machine_local unsigned flagResult;	// Unmasked, so carries show
+
+
+inline uint8_t parity(uint8_t val)
+{
+	val ^= val >> 4;
+	val ^= val >> 2;
+	val ^= val >> 1;
+
+	return (val & 1) ? 0x00 : 0x04;
+}
+
+
+static void resolveFlags()
+{
+	unsigned sum = flagResult;
+	unsigned cbits = flagAcu ^ flagOperand ^ sum;
+	unsigned flags;
+
+	switch (flagOp)
+	{
+	case FlagsKnown:
+	default:
+		return;
+	case FlagsAdd:
+		flags = (sum & 0xa8) | (((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
+			(((cbits >> 6) ^ (cbits >> 5)) & 4) | ((cbits >> 8) & 1);
+		break;
+	case FlagsSub:
+		flags = (sum & 0xa8) | (((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
+			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 | ((cbits >> 8) & 1);
+		break;
+	case FlagsCompare:
+		flags = (sum & 0x80) | (((sum & 0xff) == 0) << 6) | (flagOperand & 0x28) |
+			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
+			(cbits & 0x10) | ((cbits >> 8) & 1);
+		break;
+	case FlagsAnd:
+		flags = (sum & 0xa8) | ((sum == 0) << 6) | 0x10 | parity(sum);
+		break;
+	case FlagsLogic:
+		flags = (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
+		break;
+	case FlagsInc:
+		flags = (sum & 0xa8) | (((sum & 0xff) == 0) << 6) |
+			(((sum & 0xf) == 0) << 4) | ((sum == 0x80) << 2) | flagOperand;
+		break;
+	case FlagsDec:
+		flags = (sum & 0xa8) | (((sum & 0xff) == 0) << 6) |
+			(((sum & 0xf) == 0xf) << 4) | ((sum == 0x7f) << 2) | 2 | flagOperand;
+		break;
+	}
+
+	reg.af.low = flags;
+	flagOp = FlagsKnown;
+}
+
+
+inline void noteFlags(FlagOp op, unsigned acu, unsigned operand, unsigned result)
+{
+	flagOp = op;
+	flagAcu = acu;
+	flagOperand = operand;
+	flagResult = result;
+
+#ifdef EAGER_FLAGS
+	resolveFlags();
+#endif
+}
+
+
+inline unsigned carry()
+{
+	switch (flagOp)
+	{
+	case FlagsKnown:
+		return reg.af.word & CarryFlag;
+	case FlagsAdd:
+	case FlagsSub:
+	case FlagsCompare:
+		return (flagResult >> 8) & 1;
+	case FlagsAnd:
+	case FlagsLogic:
+		return 0;
+	default:
+		return flagOperand;
+	}
 }
 
+
 inline bool testFlag(uint8_t flag)
 {
-	return AF & flag;
+	if (flagOp != FlagsKnown)
+	{
+		if (flag == CarryFlag)
+			return carry();
+		if (flag == ZeroFlag)
+			return (flagResult & 0xff) == 0;
+
+		resolveFlags();
+	}
+
+	return reg.af.word & flag;
+}
+
+
+// The 8-bit arithmetic on A, and the flags for INC and DEC of a register
+// that already holds the result
+
+inline void add8(unsigned val, unsigned carryIn)
+{
+	unsigned acu = reg.af.high;
+	unsigned sum = acu + val + carryIn;
+
+	reg.af.high = sum;
+	noteFlags(FlagsAdd, acu, val, sum);
+}
+
+inline void sub8(unsigned val, unsigned carryIn)
+{
+	unsigned acu = reg.af.high;
+	unsigned sum = acu - val - carryIn;
+
+	reg.af.high = sum;
+	noteFlags(FlagsSub, acu, val, sum);
+}
+
+inline void compare8(unsigned val)
+{
+	unsigned acu = reg.af.high;
+	noteFlags(FlagsCompare, acu, val, acu - val);
+}
+
+inline void and8(unsigned val)
+{
+	unsigned sum = reg.af.high & val;
+
+	reg.af.high = sum;
+	noteFlags(FlagsAnd, 0, 0, sum);
+}
+
+inline void xor8(unsigned val)
+{
+	unsigned sum = reg.af.high ^ val;
+
+	reg.af.high = sum;
+	noteFlags(FlagsLogic, 0, 0, sum);
+}
+
+inline void or8(unsigned val)
+{
+	unsigned sum = reg.af.high | val;
+
+	reg.af.high = sum;
+	noteFlags(FlagsLogic, 0, 0, sum);
+}
+
+inline void incFlags(unsigned result)
+{
+	noteFlags(FlagsInc, 0, carry(), result);
+}
+
+inline void decFlags(unsigned result)
+{
+	noteFlags(FlagsDec, 0, carry(), result);
+}
+
+
+//-------------------------------------------------------------------------
+// Instruction timing
+//
+// T-states for each opcode. Conditional jumps, calls and returns are
+// listed with their not-taken time, the extra is added when the branch
+// is taken. The prefix bytes have a zero entry in the main table since the
+// prefix tables include them.
+//-------------------------------------------------------------------------
+
+static const uint8_t mainCycles[256] =
+{
+	 4, 10,  7,  6,  4,  4,  7,  4,  4, 11,  7,  6,  4,  4,  7,  4,	// 00
+	 8, 10,  7,  6,  4,  4,  7,  4, 12, 11,  7,  6,  4,  4,  7,  4,	// 10
+	 7, 10, 16,  6,  4,  4,  7,  4,  7, 11, 16,  6,  4,  4,  7,  4,	// 20
+	 7, 10, 13,  6, 11, 11, 10,  4,  7, 11, 13,  6,  4,  4,  7,  4,	// 30
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// 40
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// 50
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// 60
+	 7,  7,  7,  7,  7,  7,  4,  7,  4,  4,  4,  4,  4,  4,  7,  4,	// 70
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// 80
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// 90
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// A0
+	 4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,	// B0
+	 5, 10, 10, 10, 10, 11,  7, 11,  5, 10, 10,  0, 10, 10,  7, 11,	// C0
+	 5, 10, 10, 11, 10, 11,  7, 11,  5,  4, 10, 11, 10,  0,  7, 11,	// D0
+	 5, 10, 10, 19, 10, 11,  7, 11,  5,  4, 10,  4, 10,  0,  7, 11,	// E0
+	 5, 10, 10,  4, 10, 11,  7, 11,  5,  6, 10,  4, 10,  0,  7, 11,	// F0
+};
+
+// DD and FD prefixed instructions, including the prefix. Anything not
+// listed just costs the prefix, the opcode then runs unprefixed.
+
+static const uint8_t indexCycles[256] =
+{
+	 4,  4,  4,  4,  4,  4,  4,  4,  4, 15,  4,  4,  4,  4,  4,  4,	// 00
+	 4,  4,  4,  4,  4,  4,  4,  4,  4, 15,  4,  4,  4,  4,  4,  4,	// 10
+	 4, 14, 20, 10,  8,  8, 11,  4,  4, 15, 20, 10,  8,  8, 11,  4,	// 20
+	 4,  4,  4,  4, 23, 23, 19,  4,  4, 15,  4,  4,  4,  4,  4,  4,	// 30
+	 4,  4,  4,  4,  8,  8, 19,  4,  4,  4,  4,  4,  8,  8, 19,  4,	// 40
+	 4,  4,  4,  4,  8,  8, 19,  4,  4,  4,  4,  4,  8,  8, 19,  4,	// 50
+	 8,  8,  8,  8,  8,  8, 19,  8,  8,  8,  8,  8,  8,  8, 19,  8,	// 60
+	19, 19, 19, 19, 19, 19,  4, 19,  4,  4,  4,  4,  8,  8, 19,  4,	// 70
+	 4,  4,  4,  4,  8,  8, 19,  4,  4,  4,  4,  4,  8,  8, 19,  4,	// 80
+	 4,  4,  4,  4,  8,  8, 19,  4,  4,  4,  4,  4,  8,  8, 19,  4,	// 90
+	 4,  4,  4,  4,  8,  8, 19,  4,  4,  4,  4,  4,  8,  8, 19,  4,	// A0
+	 4,  4,  4,  4,  8,  8, 19,  4,  4,  4,  4,  4,  8,  8, 19,  4,	// B0
+	 4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  0,  4,  4,  4,  4,	// C0
+	 4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,  4,	// D0
+	 4, 14,  4, 23,  4, 15,  4,  4,  4,  8,  4,  4,  4,  4,  4,  4,	// E0
+	 4,  4,  4,  4,  4,  4,  4,  4,  4, 10,  4,  4,  4,  4,  4,  4,	// F0
+};
+
+// ED prefixed instructions, including the prefix. The repeating block
+// instructions are zero here and are counted as they iterate.
+
+static const uint8_t extendedCycles[256] =
+{
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// 00
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// 10
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// 20
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// 30
+	12, 12, 15, 20,  8, 14,  8,  9, 12, 12, 15, 20,  8, 14,  8,  9,	// 40
+	12, 12, 15, 20,  8, 14,  8,  9, 12, 12, 15, 20,  8, 14,  8,  9,	// 50
+	12, 12, 15, 20,  8, 14,  8, 18, 12, 12, 15, 20,  8, 14,  8, 18,	// 60
+	12, 12, 15, 20,  8, 14,  8,  8, 12, 12, 15, 20,  8, 14,  8,  8,	// 70
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// 80
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// 90
+	16, 16, 16, 16,  8,  8,  8,  8, 16, 16, 16, 16,  8,  8,  8,  8,	// A0
+	 0,  0,  0,  0,  8,  8,  8,  8,  0,  0,  0,  0,  8,  8,  8,  8,	// B0
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// C0
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// D0
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// E0
+	 8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,  8,	// F0
+};
+
+// CB prefixed instructions. Register operands take 8, (HL) takes 12 for
+// BIT and 15 otherwise. The DD/FD CB forms take 20 and 23.
+
+inline unsigned int bitCycles(unsigned int op, bool indexed)
+{
+	if ((op & 7) != 6 && !indexed)
+		return 8;
+
+	return (((op & 0xc0) == 0x40) ? 12 : 15) + (indexed ? 8 : 0);
 }
 
 
@@ -96,26 +394,38 @@ inline void writeWord(uint16_t addr, uint16_t val)
 
 static void push(uint16_t val)
 {
-	writeRam(--SP, val >> 8);
-	writeRam(--SP, val & 0xff);
+	writeRam(--reg.sp, val >> 8);
+	writeRam(--reg.sp, val & 0xff);
 }
 
 
 static uint16_t pop()
 {
-	uint16_t val = readRam(SP++);
-	val |= (readRam(SP++) << 8);
+	uint16_t val = readRam(reg.sp++);
+	val |= (readRam(reg.sp++) << 8);
 
 	return val;
 }
 
 
+static void conditionalJumpRelative(bool cond)
+{
+	if (cond)
+	{
+		reg.pc += (signed char) readRam(reg.pc) + 1;
+		cycles += 5;
+	}
+	else
+		++reg.pc;
+}
+
+
 static void conditionalJump(bool cond)
 {
 	if (cond)
-		PC = readWord(PC);
+		reg.pc = readWord(reg.pc);
 	else
-		PC += 2;
+		reg.pc += 2;
 }
 
 
@@ -123,31 +433,28 @@ static void conditionalCall(bool cond)
 {
     if (cond)
 	{
-		uint16_t adrr = readWord(PC);
-		push(PC+2);
-		PC = adrr;
+		uint16_t adrr = readWord(reg.pc);
+		push(reg.pc+2);
+		reg.pc = adrr;
+		cycles += 7;
     }
     else
-		PC += 2;
+		reg.pc += 2;
 }
 
 
-inline uint8_t parity(uint8_t val)
+static void conditionalReturn(bool cond)
 {
-	bool p = true;
-
-	while (val)
+	if (cond)
 	{
-		p = !p;
-		val = val & (val - 1);
+		reg.pc = pop();
+		cycles += 6;
 	}
-
-	return p ? 0x04 : 0x00;
 }
 
 
 template<typename T>
-inline void swap(T a, T b)
+inline void swap(T &a, T &b)
 {
 	T tmp = a;
 	a = b;
@@ -155,6 +462,110 @@ inline void swap(T a, T b)
 }
 
 
+// The repeating block instructions run one iteration per step. If there's
+// more to do the PC goes back to the start of the instruction so that it
+// runs again, which lets the rest of the machine in between iterations.
+// Each iteration that repeats takes 21 T-states and the last one 16.
+//
+// LDIR, LDDR, CPIR and CPDR offer the memory up to BlockSlice iterations
+// at once, and only do the one if it turns them down.
+
+const unsigned BlockSlice = 64;
+
+inline unsigned blockCount()
+{
+	unsigned count = reg.bc.word ? reg.bc.word : 0x10000;
+
+	return count < BlockSlice ? count : BlockSlice;
+}
+
+inline void blockRepeat(unsigned iterations, bool more)
+{
+	cycles += 21 * iterations;
+
+	if (more)
+		reg.pc -= 2;
+	else
+		cycles -= 5;		/* last iteration doesn't repeat */
+}
+
+static void repeatLoad(int step)
+{
+	unsigned count = blockCount();
+	int last = copyRam(reg.hl.word, reg.de.word, count, step);
+
+	if (last < 0)
+	{
+		count = 1;
+		last = readRam(reg.hl.word);
+		writeRam(reg.de.word, last);
+	}
+
+	reg.hl.word += step * count;
+	reg.de.word += step * count;
+	reg.bc.word -= count;
+	blockRepeat(count, reg.bc.word != 0);
+
+	unsigned acu = last + reg.af.high;
+	reg.af.word = (reg.af.word & ~0x3e) | (acu & 8) | ((acu & 2) << 4) |
+		((reg.bc.word != 0) << 2);
+}
+
+static void repeatCompare(int step)
+{
+	unsigned acu = reg.af.high, temp, sum, cbits, more;
+	unsigned looked = findRam(reg.hl.word, blockCount(), acu, step);
+
+	if (!looked)
+		looked = 1;
+
+	temp = readRam(reg.hl.word + step * (looked - 1));
+	reg.hl.word += step * looked;
+	reg.bc.word -= looked;
+	more = reg.bc.word != 0;
+	sum = acu - temp;
+	blockRepeat(looked, more && sum != 0);
+
+	cbits = acu ^ temp ^ sum;
+	reg.af.word = (reg.af.word & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
+		(((sum - ((cbits&16)>>4))&2) << 4) |
+		(cbits & 16) | ((sum - ((cbits >> 4) & 1)) & 8) |
+		more << 2 | 2;
+	if ((sum & 15) == 8 && (cbits & 16) != 0)
+		reg.af.word &= ~8;
+}
+
+// INIR, INDR, OTIR and OTDR, counting down in B. The port gets the same
+// chance to take up to BlockSlice bytes at once.
+
+static void repeatIO(int step, bool out)
+{
+	unsigned count = reg.bc.high ? reg.bc.high : 256;
+	if (count > BlockSlice)
+		count = BlockSlice;
+
+	unsigned done = out ? portOutBlock(reg.bc.low, reg.hl.word, count, step) :
+		portInBlock(reg.bc.low, reg.hl.word, count, step);
+
+	if (!done)
+	{
+		done = 1;
+
+		if (out)
+			portOut(reg.bc.low, readRam(reg.hl.word));
+		else
+			writeRam(reg.hl.word, portIn(reg.bc.low));
+	}
+
+	reg.hl.word += step * done;
+	reg.bc.high -= done;
+	blockRepeat(done, reg.bc.high != 0);
+
+	setFlag(SubFlag, 1);
+	setFlag(ZeroFlag, reg.bc.high == 0);
+}
+
+
 //-------------------------------------------------------------------------
 //
 // Emulate
@@ -166,15 +577,17 @@ cb_prefix(uint16_t adr)
 {
     unsigned int temp = 0, acu = 0, op, cbits;
 
-		switch ((op = readRam(PC)) & 7) {
-		case 0: ++PC; acu = highReg(BC); break;
-		case 1: ++PC; acu = lowReg(BC); break;
-		case 2: ++PC; acu = highReg(DE); break;
-		case 3: ++PC; acu = lowReg(DE); break;
-		case 4: ++PC; acu = highReg(HL); break;
-		case 5: ++PC; acu = lowReg(HL); break;
-		case 6: ++PC; acu = readRam(adr);  break;
-		case 7: ++PC; acu = highReg(AF); break;
+		resolveFlags();
+
+		switch ((op = readRam(reg.pc)) & 7) {
+		case 0: ++reg.pc; acu = reg.bc.high; break;
+		case 1: ++reg.pc; acu = reg.bc.low; break;
+		case 2: ++reg.pc; acu = reg.de.high; break;
+		case 3: ++reg.pc; acu = reg.de.low; break;
+		case 4: ++reg.pc; acu = reg.hl.high; break;
+		case 5: ++reg.pc; acu = reg.hl.low; break;
+		case 6: ++reg.pc; acu = readRam(adr);  break;
+		case 7: ++reg.pc; acu = reg.af.high; break;
 		}
 		switch (op & 0xc0) {
 		case 0x00:		/* shift/rotate */
@@ -211,19 +624,19 @@ cb_prefix(uint16_t adr)
 				temp = acu >> 1;
 				cbits = acu & 1;
 			cbshflg1:
-				AF = (AF & ~0xff) | (temp & 0xa8) |
+				reg.af.word = (reg.af.word & ~0xff) | (temp & 0xa8) |
 					(((temp & 0xff) == 0) << 6) |
 					parity(temp) | !!cbits;
 			}
 			break;
 		case 0x40:		/* BIT */
 			if (acu & (1 << ((op >> 3) & 7)))
-				AF = (AF & ~0xfe) | 0x10 |
+				reg.af.word = (reg.af.word & ~0xfe) | 0x10 |
 				(((op & 0x38) == 0x38) << 7);
 			else
-				AF = (AF & ~0xfe) | 0x54;
+				reg.af.word = (reg.af.word & ~0xfe) | 0x54;
 			if ((op&7) != 6)
-				AF |= (acu & 0x28);
+				reg.af.word |= (acu & 0x28);
 			temp = acu;
 			break;
 		case 0x80:		/* RES */
@@ -234,2187 +647,964 @@ cb_prefix(uint16_t adr)
 			break;
 		}
 		switch (op & 7) {
-		case 0: SethighReg(BC, temp); break;
-		case 1: SetlowReg(BC, temp); break;
-		case 2: SethighReg(DE, temp); break;
-		case 3: SetlowReg(DE, temp); break;
-		case 4: SethighReg(HL, temp); break;
-		case 5: SetlowReg(HL, temp); break;
+		case 0: reg.bc.high = temp; break;
+		case 1: reg.bc.low = temp; break;
+		case 2: reg.de.high = temp; break;
+		case 3: reg.de.low = temp; break;
+		case 4: reg.hl.high = temp; break;
+		case 5: reg.hl.low = temp; break;
 		case 6: writeRam(adr, temp);  break;
-		case 7: SethighReg(AF, temp); break;
+		case 7: reg.af.high = temp; break;
 		}
 }
 
-static uint16_t
-dfd_prefix(uint16_t IXY)
+//-------------------------------------------------------------------------
+//
+// Power-on reset. The real chip only guarantees PC, I, R and the interrupt
+// state, but starting from all zeros keeps runs repeatable.
+//
+//-------------------------------------------------------------------------
+
+void z80reset()
 {
-    unsigned int temp, adr, acu, op, sum, cbits;
-
-		switch (++PC, op = readRam(PC-1)) {
-		case 0x09:			/* ADD IXY,BC */
-			IXY &= 0xffff;
-			BC &= 0xffff;
-			sum = IXY + BC;
-			cbits = (IXY ^ BC ^ sum) >> 8;
-			IXY = sum;
-			AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x19:			/* ADD IXY,DE */
-			IXY &= 0xffff;
-			DE &= 0xffff;
-			sum = IXY + DE;
-			cbits = (IXY ^ DE ^ sum) >> 8;
-			IXY = sum;
-			AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x21:			/* LD IXY,nnnn */
-			IXY = readWord(PC);
-			PC += 2;
-			break;
-		case 0x22:			/* LD (nnnn),IXY */
-			temp = readWord(PC);
-			writeWord(temp, IXY);
-			PC += 2;
-			break;
-		case 0x23:			/* INC IXY */
-			++IXY;
-			break;
-		case 0x24:			/* INC IXYH */
-			IXY += 0x100;
-			temp = highReg(IXY);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				(((temp & 0xf) == 0) << 4) |
-				((temp == 0x80) << 2);
-			break;
-		case 0x25:			/* DEC IXYH */
-			IXY -= 0x100;
-			temp = highReg(IXY);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				(((temp & 0xf) == 0xf) << 4) |
-				((temp == 0x7f) << 2) | 2;
-			break;
-		case 0x26:			/* LD IXYH,nn */
-			SethighReg(IXY, readRam(PC)); ++PC;
-			break;
-		case 0x29:			/* ADD IXY,IXY */
-			IXY &= 0xffff;
-			sum = IXY + IXY;
-			cbits = (IXY ^ IXY ^ sum) >> 8;
-			IXY = sum;
-			AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x2A:			/* LD IXY,(nnnn) */
-			temp = readWord(PC);
-			IXY = readWord(temp);
-			PC += 2;
-			break;
-		case 0x2B:			/* DEC IXY */
-			--IXY;
-			break;
-		case 0x2C:			/* INC IXYL */
-			temp = lowReg(IXY)+1;
-			SetlowReg(IXY, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				(((temp & 0xf) == 0) << 4) |
-				((temp == 0x80) << 2);
-			break;
-		case 0x2D:			/* DEC IXYL */
-			temp = lowReg(IXY)-1;
-			SetlowReg(IXY, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				(((temp & 0xf) == 0xf) << 4) |
-				((temp == 0x7f) << 2) | 2;
-			break;
-		case 0x2E:			/* LD IXYL,nn */
-			SetlowReg(IXY, readRam(PC)); ++PC;
-			break;
-		case 0x34:			/* INC (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr)+1;
-			writeRam(adr, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				(((temp & 0xf) == 0) << 4) |
-				((temp == 0x80) << 2);
-			break;
-		case 0x35:			/* DEC (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr)-1;
-			writeRam(adr, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				(((temp & 0xf) == 0xf) << 4) |
-				((temp == 0x7f) << 2) | 2;
-			break;
-		case 0x36:			/* LD (IXY+dd),nn */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, readRam(PC)); ++PC;
-			break;
-		case 0x39:			/* ADD IXY,SP */
-			IXY &= 0xffff;
-			SP &= 0xffff;
-			sum = IXY + SP;
-			cbits = (IXY ^ SP ^ sum) >> 8;
-			IXY = sum;
-			AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x44:			/* LD B,IXYH */
-			SethighReg(BC, highReg(IXY));
-			break;
-		case 0x45:			/* LD B,IXYL */
-			SethighReg(BC, lowReg(IXY));
-			break;
-		case 0x46:			/* LD B,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SethighReg(BC, readRam(adr));
-			break;
-		case 0x4C:			/* LD C,IXYH */
-			SetlowReg(BC, highReg(IXY));
-			break;
-		case 0x4D:			/* LD C,IXYL */
-			SetlowReg(BC, lowReg(IXY));
-			break;
-		case 0x4E:			/* LD C,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SetlowReg(BC, readRam(adr));
-			break;
-		case 0x54:			/* LD D,IXYH */
-			SethighReg(DE, highReg(IXY));
-			break;
-		case 0x55:			/* LD D,IXYL */
-			SethighReg(DE, lowReg(IXY));
-			break;
-		case 0x56:			/* LD D,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SethighReg(DE, readRam(adr));
-			break;
-		case 0x5C:			/* LD E,H */
-			SetlowReg(DE, highReg(IXY));
-			break;
-		case 0x5D:			/* LD E,L */
-			SetlowReg(DE, lowReg(IXY));
-			break;
-		case 0x5E:			/* LD E,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SetlowReg(DE, readRam(adr));
-			break;
-		case 0x60:			/* LD IXYH,B */
-			SethighReg(IXY, highReg(BC));
-			break;
-		case 0x61:			/* LD IXYH,C */
-			SethighReg(IXY, lowReg(BC));
-			break;
-		case 0x62:			/* LD IXYH,D */
-			SethighReg(IXY, highReg(DE));
-			break;
-		case 0x63:			/* LD IXYH,E */
-			SethighReg(IXY, lowReg(DE));
-			break;
-		case 0x64:			/* LD IXYH,IXYH */
-			/* nop */
-			break;
-		case 0x65:			/* LD IXYH,IXYL */
-			SethighReg(IXY, lowReg(IXY));
-			break;
-		case 0x66:			/* LD H,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SethighReg(HL, readRam(adr));
-			break;
-		case 0x67:			/* LD IXYH,A */
-			SethighReg(IXY, highReg(AF));
-			break;
-		case 0x68:			/* LD IXYL,B */
-			SetlowReg(IXY, highReg(BC));
-			break;
-		case 0x69:			/* LD IXYL,C */
-			SetlowReg(IXY, lowReg(BC));
-			break;
-		case 0x6A:			/* LD IXYL,D */
-			SetlowReg(IXY, highReg(DE));
-			break;
-		case 0x6B:			/* LD IXYL,E */
-			SetlowReg(IXY, lowReg(DE));
-			break;
-		case 0x6C:			/* LD IXYL,IXYH */
-			SetlowReg(IXY, highReg(IXY));
-			break;
-		case 0x6D:			/* LD IXYL,IXYL */
-			/* nop */
-			break;
-		case 0x6E:			/* LD L,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SetlowReg(HL, readRam(adr));
-			break;
-		case 0x6F:			/* LD IXYL,A */
-			SetlowReg(IXY, highReg(AF));
-			break;
-		case 0x70:			/* LD (IXY+dd),B */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, highReg(BC));
-			break;
-		case 0x71:			/* LD (IXY+dd),C */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, lowReg(BC));
-			break;
-		case 0x72:			/* LD (IXY+dd),D */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, highReg(DE));
-			break;
-		case 0x73:			/* LD (IXY+dd),E */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, lowReg(DE));
-			break;
-		case 0x74:			/* LD (IXY+dd),H */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, highReg(HL));
-			break;
-		case 0x75:			/* LD (IXY+dd),L */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, lowReg(HL));
-			break;
-		case 0x77:			/* LD (IXY+dd),A */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			writeRam(adr, highReg(AF));
-			break;
-		case 0x7C:			/* LD A,IXYH */
-			SethighReg(AF, highReg(IXY));
-			break;
-		case 0x7D:			/* LD A,IXYL */
-			SethighReg(AF, lowReg(IXY));
-			break;
-		case 0x7E:			/* LD A,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			SethighReg(AF, readRam(adr));
-			break;
-		case 0x84:			/* ADD A,IXYH */
-			temp = highReg(IXY);
-			acu = highReg(AF);
-			sum = acu + temp;
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				((cbits >> 8) & 1);
-			break;
-		case 0x85:			/* ADD A,IXYL */
-			temp = lowReg(IXY);
-			acu = highReg(AF);
-			sum = acu + temp;
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				((cbits >> 8) & 1);
-			break;
-		case 0x86:			/* ADD A,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr);
-			acu = highReg(AF);
-			sum = acu + temp;
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				((cbits >> 8) & 1);
-			break;
-		case 0x8C:			/* ADC A,IXYH */
-			temp = highReg(IXY);
-			acu = highReg(AF);
-			sum = acu + temp + testFlag(CarryFlag);
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				((cbits >> 8) & 1);
-			break;
-		case 0x8D:			/* ADC A,IXYL */
-			temp = lowReg(IXY);
-			acu = highReg(AF);
-			sum = acu + temp + testFlag(CarryFlag);
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				((cbits >> 8) & 1);
-			break;
-		case 0x8E:			/* ADC A,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr);
-			acu = highReg(AF);
-			sum = acu + temp + testFlag(CarryFlag);
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				((cbits >> 8) & 1);
-			break;
-		case 0x94:			/* SUB IXYH */
-			temp = highReg(IXY);
-			acu = highReg(AF);
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				((cbits >> 8) & 1);
-			break;
-		case 0x95:			/* SUB IXYL */
-			temp = lowReg(IXY);
-			acu = highReg(AF);
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				((cbits >> 8) & 1);
-			break;
-		case 0x96:			/* SUB (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr);
-			acu = highReg(AF);
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				((cbits >> 8) & 1);
-			break;
-		case 0x9C:			/* SBC A,IXYH */
-			temp = highReg(IXY);
-			acu = highReg(AF);
-			sum = acu - temp - testFlag(CarryFlag);
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				((cbits >> 8) & 1);
-			break;
-		case 0x9D:			/* SBC A,IXYL */
-			temp = lowReg(IXY);
-			acu = highReg(AF);
-			sum = acu - temp - testFlag(CarryFlag);
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				((cbits >> 8) & 1);
-			break;
-		case 0x9E:			/* SBC A,(IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr);
-			acu = highReg(AF);
-			sum = acu - temp - testFlag(CarryFlag);
-			cbits = acu ^ temp ^ sum;
-			AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-				(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				((cbits >> 8) & 1);
-			break;
-		case 0xA4:			/* AND IXYH */
-			sum = ((AF & (IXY)) >> 8) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) |
-				((sum == 0) << 6) | 0x10 | parity(sum);
-			break;
-		case 0xA5:			/* AND IXYL */
-			sum = ((AF >> 8) & IXY) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-				((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xA6:			/* AND (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			sum = ((AF >> 8) & readRam(adr)) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-				((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xAC:			/* XOR IXYH */
-			sum = ((AF ^ (IXY)) >> 8) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xAD:			/* XOR IXYL */
-			sum = ((AF >> 8) ^ IXY) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xAE:			/* XOR (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			sum = ((AF >> 8) ^ readRam(adr)) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xB4:			/* OR IXYH */
-			sum = ((AF | (IXY)) >> 8) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xB5:			/* OR IXYL */
-			sum = ((AF >> 8) | IXY) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xB6:			/* OR (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			sum = ((AF >> 8) | readRam(adr)) & 0xff;
-			AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-			break;
-		case 0xBC:			/* CP IXYH */
-			temp = highReg(IXY);
-			AF = (AF & ~0x28) | (temp & 0x28);
-			acu = highReg(AF);
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xff) | (sum & 0x80) |
-				(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0xBD:			/* CP IXYL */
-			temp = lowReg(IXY);
-			AF = (AF & ~0x28) | (temp & 0x28);
-			acu = highReg(AF);
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xff) | (sum & 0x80) |
-				(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0xBE:			/* CP (IXY+dd) */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			temp = readRam(adr);
-			AF = (AF & ~0x28) | (temp & 0x28);
-			acu = highReg(AF);
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xff) | (sum & 0x80) |
-				(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0xCB:			/* CB prefix */
-			adr = IXY + (signed char) readRam(PC); ++PC;
-			cb_prefix(adr);
-			break;
-		case 0xE1:			/* pop IXY */
-			IXY = pop();
-			break;
-		case 0xE3:			/* EX (SP),IXY */
-			temp = IXY; IXY = pop(); push(temp);
-			break;
-		case 0xE5:			/* push IXY */
-			push(IXY);
-			break;
-		case 0xE9:			/* JP (IXY) */
-			PC = IXY;
-			break;
-		case 0xF9:			/* LD SP,IXY */
-			SP = IXY;
-			break;
-		default: PC--;		/* ignore DD */
-		}
-    return(IXY);
+	reg = RegisterFile();
+	flagOp = FlagsKnown;
+	cycles = 0;
+	pending = 0;
+	interrupts = 0;
 }
 
 
-void z80step()
+//-------------------------------------------------------------------------
+//
+// Peek at (and poke) the processor state from outside the core.
+//
+//-------------------------------------------------------------------------
+
+uint16_t z80pc()		{ return reg.pc; }
+uint16_t z80sp()		{ return reg.sp; }
+uint64_t z80cycles()	{ return cycles; }
+bool     z80halted()	{ return pending & Halted; }
+uint64_t z80interrupts()	{ return interrupts; }
+
+void z80getRegisters(Z80Registers &regs)
 {
-    unsigned int temp, acu, sum, cbits;
-    unsigned int op;
+	resolveFlags();
 
-    switch(++PC,readRam(PC-1)) {
-	case 0x00:			/* NOP */
-		break;
-	case 0x01:			/* LD BC,nnnn */
-		BC = readWord(PC);
-		PC += 2;
-		break;
-	case 0x02:			/* LD (BC),A */
-		writeRam(BC, highReg(AF));
-		break;
-	case 0x03:			/* INC BC */
-		++BC;
-		break;
-	case 0x04:			/* INC B */
-		BC += 0x100;
-		temp = highReg(BC);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x05:			/* DEC B */
-		BC -= 0x100;
-		temp = highReg(BC);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x06:			/* LD B,nn */
-		SethighReg(BC, readRam(PC)); ++PC;
-		break;
-	case 0x07:			/* RLCA */
-		AF = ((AF >> 7) & 0x0128) | ((AF << 1) & ~0x1ff) |
-			(AF & 0xc4) | ((AF >> 15) & 1);
-		break;
-	case 0x08:			/* EX AF,AF' */
-		swap(AF, AFalt);
-		break;
-	case 0x09:			/* ADD HL,BC */
-		HL &= 0xffff;
-		BC &= 0xffff;
-		sum = HL + BC;
-		cbits = (HL ^ BC ^ sum) >> 8;
-		HL = sum;
-		AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0x0A:			/* LD A,(BC) */
-		SethighReg(AF, readRam(BC));
-		break;
-	case 0x0B:			/* DEC BC */
-		--BC;
-		break;
-	case 0x0C:			/* INC C */
-		temp = lowReg(BC)+1;
-		SetlowReg(BC, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x0D:			/* DEC C */
-		temp = lowReg(BC)-1;
-		SetlowReg(BC, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x0E:			/* LD C,nn */
-		SetlowReg(BC, readRam(PC)); ++PC;
-		break;
-	case 0x0F:			/* RRCA */
-		temp = highReg(AF);
-		sum = temp >> 1;
-		AF = ((temp & 1) << 15) | (sum << 8) |
-			(sum & 0x28) | (AF & 0xc4) | (temp & 1);
-		break;
-	case 0x10:			/* DJNZ dd */
-		PC += ((BC -= 0x100) & 0xff00) ? (signed char) readRam(PC) + 1 : 1;
-		break;
-	case 0x11:			/* LD DE,nnnn */
-		DE = readWord(PC);
-		PC += 2;
-		break;
-	case 0x12:			/* LD (DE),A */
-		writeRam(DE, highReg(AF));
-		break;
-	case 0x13:			/* INC DE */
-		++DE;
-		break;
-	case 0x14:			/* INC D */
-		DE += 0x100;
-		temp = highReg(DE);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x15:			/* DEC D */
-		DE -= 0x100;
-		temp = highReg(DE);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x16:			/* LD D,nn */
-		SethighReg(DE, readRam(PC)); ++PC;
-		break;
-	case 0x17:			/* RLA */
-		AF = ((AF << 8) & 0x0100) | ((AF >> 7) & 0x28) | ((AF << 1) & ~0x01ff) |
-			(AF & 0xc4) | ((AF >> 15) & 1);
-		break;
-	case 0x18:			/* JR dd */
-		PC += (1) ? (signed char) readRam(PC) + 1 : 1;
-		break;
-	case 0x19:			/* ADD HL,DE */
-		HL &= 0xffff;
-		DE &= 0xffff;
-		sum = HL + DE;
-		cbits = (HL ^ DE ^ sum) >> 8;
-		HL = sum;
-		AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
+	regs.af = reg.af.word;
+	regs.bc = reg.bc.word;
+	regs.de = reg.de.word;
+	regs.hl = reg.hl.word;
+	regs.ix = reg.ix.word;
+	regs.iy = reg.iy.word;
+	regs.sp = reg.sp;
+	regs.pc = reg.pc;
+	regs.ir = reg.ir.word;
+	regs.iff = reg.iff;
+	regs.im = reg.im;
+	regs.pending = pending;
+	regs.vector = intVector;
+	regs.afAlt = reg.afAlt.word;
+	regs.bcAlt = reg.bcAlt.word;
+	regs.deAlt = reg.deAlt.word;
+	regs.hlAlt = reg.hlAlt.word;
+}
+
+void z80setRegisters(const Z80Registers &regs)
+{
+	reg.af.word = regs.af;
+	flagOp = FlagsKnown;
+	reg.bc.word = regs.bc;
+	reg.de.word = regs.de;
+	reg.hl.word = regs.hl;
+	reg.ix.word = regs.ix;
+	reg.iy.word = regs.iy;
+	reg.sp = regs.sp;
+	reg.pc = regs.pc;
+	reg.ir.word = regs.ir;
+	reg.iff = regs.iff;
+	reg.im = regs.im;
+	pending = regs.pending;
+	intVector = regs.vector;
+	reg.afAlt.word = regs.afAlt;
+	reg.bcAlt.word = regs.bcAlt;
+	reg.deAlt.word = regs.deAlt;
+	reg.hlAlt.word = regs.hlAlt;
+}
+
+void z80setCycles(uint64_t count)
+{
+	cycles = count;
+}
+
+
+//-------------------------------------------------------------------------
+//
+// The main instruction set. Most of it is regular: the opcode splits into
+// fields x (top two bits), y (the middle three) and z (the bottom three),
+// and y and z pick a register, a register pair, a condition or an ALU
+// operation. Those instructions are generated from the templates below,
+// one handler per opcode with its operands fixed at compile time. The
+// odd ones out are written by hand at the end of mainOp().
+//
+// The DD and FD prefixes use the same handlers, specialised on the
+// register that stands in for HL: IX or IY in place of HL, IXH/IXL or
+// IYH/IYL in place of H and L, and (IX+d) or (IY+d) in place of (HL).
+// An instruction that uses (IX+d) keeps the real H and L for its other
+// operand. Instructions that don't involve HL ignore the prefix, which
+// costs its T-states and leaves the instruction to run on its own.
+//
+//-------------------------------------------------------------------------
+
+enum IndexMode
+{
+	UseHL,
+	UseIX,
+	UseIY,
+};
+
+template<int Index>
+inline RegisterPair &indexPair()
+{
+	if constexpr (Index == UseIX) return reg.ix;
+	else if constexpr (Index == UseIY) return reg.iy;
+	else return reg.hl;
+}
+
+// The address of the (HL) operand, which takes the displacement byte
+// after the opcode for (IX+d) and (IY+d)
+
+template<int Index>
+inline uint16_t memoryOperand()
+{
+	if constexpr (Index == UseHL)
+		return reg.hl.word;
+	else
+	{
+		uint16_t adr = indexPair<Index>().word + (signed char) readRam(reg.pc);
+		++reg.pc;
+		return adr;
+	}
+}
+
+// r: B, C, D, E, H, L, (HL), A. For (HL) the address has already been
+// worked out.
+
+template<int R, int Index>
+inline uint8_t get8(uint16_t adr)
+{
+	if constexpr (R == 0) return reg.bc.high;
+	else if constexpr (R == 1) return reg.bc.low;
+	else if constexpr (R == 2) return reg.de.high;
+	else if constexpr (R == 3) return reg.de.low;
+	else if constexpr (R == 4) return indexPair<Index>().high;
+	else if constexpr (R == 5) return indexPair<Index>().low;
+	else if constexpr (R == 6) return readRam(adr);
+	else return reg.af.high;
+}
+
+template<int R, int Index>
+inline void set8(uint16_t adr, uint8_t val)
+{
+	if constexpr (R == 0) reg.bc.high = val;
+	else if constexpr (R == 1) reg.bc.low = val;
+	else if constexpr (R == 2) reg.de.high = val;
+	else if constexpr (R == 3) reg.de.low = val;
+	else if constexpr (R == 4) indexPair<Index>().high = val;
+	else if constexpr (R == 5) indexPair<Index>().low = val;
+	else if constexpr (R == 6) writeRam(adr, val);
+	else reg.af.high = val;
+}
+
+// rr: BC, DE, HL, SP, except that PUSH and POP have AF in place of SP
+
+template<int P, int Index, bool WithAF = false>
+inline uint16_t &pair16()
+{
+	if constexpr (P == 0) return reg.bc.word;
+	else if constexpr (P == 1) return reg.de.word;
+	else if constexpr (P == 2) return indexPair<Index>().word;
+	else if constexpr (WithAF) return reg.af.word;
+	else return reg.sp;
+}
+
+// cc: NZ, Z, NC, C, PO, PE, P, M
+
+template<int Cc>
+inline bool condition()
+{
+	constexpr uint8_t flags[4] = { ZeroFlag, CarryFlag, ParityFlag, SignFlag };
+	return testFlag(flags[Cc >> 1]) == (Cc & 1);
+}
+
+// ADD, ADC, SUB, SBC, AND, XOR, OR, CP
+
+template<int Y>
+inline void alu(uint8_t val)
+{
+	if constexpr (Y == 0) add8(val, 0);
+	else if constexpr (Y == 1) add8(val, carry());
+	else if constexpr (Y == 2) sub8(val, 0);
+	else if constexpr (Y == 3) sub8(val, carry());
+	else if constexpr (Y == 4) and8(val);
+	else if constexpr (Y == 5) xor8(val);
+	else if constexpr (Y == 6) or8(val);
+	else compare8(val);
+}
+
+// Whether an instruction involves H, L, (HL) or HL, and so whether the
+// DD and FD prefixes change it
+
+constexpr bool usesHL(int op)
+{
+	int x = op >> 6, y = (op >> 3) & 7, z = op & 7;
+	auto hl = [](int r) { return r >= 4 && r <= 6; };
+
+	switch (x)
+	{
+	case 0:
+		return ((z == 4 || z == 5 || z == 6) && hl(y)) ||
+			(z == 1 && (y == 4 || (y & 1))) || (z == 3 && (y >> 1) == 2) ||
+			op == 0x22 || op == 0x2a;
+	case 1:
+		return op != 0x76 && (hl(y) || hl(z));
+	case 2:
+		return hl(z);
+	default:
+		return ((z == 1 || z == 5) && y == 4) ||
+			op == 0xcb || op == 0xe3 || op == 0xe9 || op == 0xf9;
+	}
+}
+
+template<int Index>
+static void indexedOp();
+
+
+template<int Op, int Index = UseHL>
+static void mainOp()
+{
+	constexpr int x = Op >> 6;
+	constexpr int y = (Op >> 3) & 7;
+	constexpr int z = Op & 7;
+	constexpr int p = y >> 1;
+	constexpr int q = y & 1;
+
+	// An instruction with (HL) among its operands, and the register
+	// H and L mean alongside it
+
+	constexpr bool memory = (x == 1 && (y == 6 || z == 6)) || (x == 2 && z == 6) ||
+		(x == 0 && z >= 4 && z <= 6 && y == 6);
+	constexpr int R = memory ? UseHL : Index;
+
+	if constexpr (Index != UseHL && !usesHL(Op))
+		--reg.pc;									// Prefix ignored
+	else if constexpr (x == 1 && Op != 0x76)		// LD r,r'
+	{
+		uint16_t adr = memory ? memoryOperand<Index>() : 0;
+		set8<y, R>(adr, get8<z, R>(adr));
+	}
+	else if constexpr (x == 2)						// ALU A,r
+	{
+		uint16_t adr = memory ? memoryOperand<Index>() : 0;
+		alu<y>(get8<z, R>(adr));
+	}
+	else if constexpr (x == 3 && z == 6)			// ALU A,n
+		alu<y>(readRam(reg.pc++));
+	else if constexpr (x == 0 && z == 4)			// INC r
+	{
+		uint16_t adr = memory ? memoryOperand<Index>() : 0;
+		unsigned temp = get8<y, R>(adr) + 1;
+		set8<y, R>(adr, temp);
+		incFlags(temp);
+	}
+	else if constexpr (x == 0 && z == 5)			// DEC r
+	{
+		uint16_t adr = memory ? memoryOperand<Index>() : 0;
+		unsigned temp = get8<y, R>(adr) - 1;
+		set8<y, R>(adr, temp);
+		decFlags(temp);
+	}
+	else if constexpr (x == 0 && z == 6)			// LD r,n
+	{
+		uint16_t adr = memory ? memoryOperand<Index>() : 0;
+		set8<y, R>(adr, readRam(reg.pc++));
+	}
+	else if constexpr (x == 0 && z == 1 && q == 0)	// LD rr,nn
+	{
+		pair16<p, Index>() = readWord(reg.pc);
+		reg.pc += 2;
+	}
+	else if constexpr (x == 0 && z == 1)			// ADD HL,rr
+	{
+		resolveFlags();
+		uint16_t &hl = pair16<2, Index>();
+		unsigned sum = hl + pair16<p, Index>();
+		unsigned cbits = (hl ^ pair16<p, Index>() ^ sum) >> 8;
+		hl = sum;
+		reg.af.low = (reg.af.low & ~0x3b) | ((sum >> 8) & 0x28) |
 			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0x1A:			/* LD A,(DE) */
-		SethighReg(AF, readRam(DE));
-		break;
-	case 0x1B:			/* DEC DE */
-		--DE;
-		break;
-	case 0x1C:			/* INC E */
-		temp = lowReg(DE)+1;
-		SetlowReg(DE, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x1D:			/* DEC E */
-		temp = lowReg(DE)-1;
-		SetlowReg(DE, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x1E:			/* LD E,nn */
-		SetlowReg(DE, readRam(PC)); ++PC;
-		break;
-	case 0x1F:			/* RRA */
-		temp = highReg(AF);
-		sum = temp >> 1;
-		AF = ((AF & 1) << 15) | (sum << 8) |
-			(sum & 0x28) | (AF & 0xc4) | (temp & 1);
-		break;
-	case 0x20:			/* JR NZ,dd */
-		PC += (!testFlag(ZeroFlag)) ? (signed char) readRam(PC) + 1 : 1;
-		break;
-	case 0x21:			/* LD HL,nnnn */
-		HL = readWord(PC);
-		PC += 2;
-		break;
-	case 0x22:			/* LD (nnnn),HL */
-		temp = readWord(PC);
-		writeWord(temp, HL);
-		PC += 2;
-		break;
-	case 0x23:			/* INC HL */
-		++HL;
-		break;
-	case 0x24:			/* INC H */
-		HL += 0x100;
-		temp = highReg(HL);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x25:			/* DEC H */
-		HL -= 0x100;
-		temp = highReg(HL);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x26:			/* LD H,nn */
-		SethighReg(HL, readRam(PC)); ++PC;
-		break;
-	case 0x27:			/* DAA */
-		acu = highReg(AF);
-		temp = lowDigit(acu);
-		cbits = testFlag(CarryFlag);
-		if (testFlag(SubFlag)) {	/* last operation was a subtract */
-			int hd = cbits || acu > 0x99;
-			if (testFlag(HalfFlag) || (temp > 9)) { /* adjust low digit */
-				if (temp > 5)
-					setFlag(HalfFlag, 0);
-				acu -= 6;
-				acu &= 0xff;
+	}
+	else if constexpr (x == 0 && z == 3 && q == 0)	// INC rr
+		++pair16<p, Index>();
+	else if constexpr (x == 0 && z == 3)			// DEC rr
+		--pair16<p, Index>();
+	else if constexpr (x == 0 && z == 0 && y >= 4)	// JR cc,dd
+		conditionalJumpRelative(condition<y - 4>());
+	else if constexpr (x == 3 && z == 0)			// RET cc
+		conditionalReturn(condition<y>());
+	else if constexpr (x == 3 && z == 2)			// JP cc,nnnn
+		conditionalJump(condition<y>());
+	else if constexpr (x == 3 && z == 4)			// CALL cc,nnnn
+		conditionalCall(condition<y>());
+	else if constexpr (x == 3 && z == 7)			// RST
+	{
+		push(reg.pc);
+		reg.pc = y * 8;
+	}
+	else if constexpr (x == 3 && z == 5 && q == 0)	// PUSH qq
+	{
+		if constexpr (p == 3)
+			resolveFlags();
+		push(pair16<p, Index, true>());
+	}
+	else if constexpr (x == 3 && z == 1 && q == 0)	// POP qq
+	{
+		pair16<p, Index, true>() = pop();
+		if constexpr (p == 3)
+			flagOp = FlagsKnown;
+	}
+	else
+	{
+		unsigned int temp, acu, sum, cbits;
+		unsigned int op;
+		RegisterPair &hl = indexPair<Index>();
+
+		switch (Op) {
+		case 0x00:			/* NOP */
+			break;
+		case 0x02:			/* LD (BC),A */
+			writeRam(reg.bc.word, reg.af.high);
+			break;
+		case 0x07:			/* RLCA */
+			resolveFlags();
+			reg.af.word = ((reg.af.word >> 7) & 0x0128) | ((reg.af.word << 1) & ~0x1ff) |
+				(reg.af.word & 0xc4) | ((reg.af.word >> 15) & 1);
+			break;
+		case 0x08:			/* EX AF,AF' */
+			resolveFlags();
+			swap(reg.af, reg.afAlt);
+			break;
+		case 0x0A:			/* LD A,(BC) */
+			reg.af.high = readRam(reg.bc.word);
+			break;
+		case 0x0F:			/* RRCA */
+			resolveFlags();
+			temp = reg.af.high;
+			sum = temp >> 1;
+			reg.af.word = ((temp & 1) << 15) | (sum << 8) |
+				(sum & 0x28) | (reg.af.word & 0xc4) | (temp & 1);
+			break;
+		case 0x10:			/* DJNZ dd */
+			conditionalJumpRelative(--reg.bc.high);
+			break;
+		case 0x12:			/* LD (DE),A */
+			writeRam(reg.de.word, reg.af.high);
+			break;
+		case 0x17:			/* RLA */
+			resolveFlags();
+			reg.af.word = ((reg.af.word << 8) & 0x0100) | ((reg.af.word >> 7) & 0x28) | ((reg.af.word << 1) & ~0x01ff) |
+				(reg.af.word & 0xc4) | ((reg.af.word >> 15) & 1);
+			break;
+		case 0x18:			/* JR dd */
+			reg.pc += (signed char) readRam(reg.pc) + 1;
+			break;
+		case 0x1A:			/* LD A,(DE) */
+			reg.af.high = readRam(reg.de.word);
+			break;
+		case 0x1F:			/* RRA */
+			resolveFlags();
+			temp = reg.af.high;
+			sum = temp >> 1;
+			reg.af.word = ((reg.af.word & 1) << 15) | (sum << 8) |
+				(sum & 0x28) | (reg.af.word & 0xc4) | (temp & 1);
+			break;
+		case 0x22:			/* LD (nnnn),HL */
+			temp = readWord(reg.pc);
+			writeWord(temp, hl.word);
+			reg.pc += 2;
+			break;
+		case 0x27:			/* DAA */
+			resolveFlags();
+			acu = reg.af.high;
+			temp = lowDigit(acu);
+			cbits = testFlag(CarryFlag);
+			if (testFlag(SubFlag)) {	/* last operation was a subtract */
+				int hd = cbits || acu > 0x99;
+				if (testFlag(HalfFlag) || (temp > 9)) { /* adjust low digit */
+					if (temp > 5)
+						setFlag(HalfFlag, 0);
+					acu -= 6;
+					acu &= 0xff;
+				}
+				if (hd)		/* adjust high digit */
+					acu -= 0x160;
 			}
-			if (hd)		/* adjust high digit */
-				acu -= 0x160;
-		}
-		else {			/* last operation was an add */
-			if (testFlag(HalfFlag) || (temp > 9)) { /* adjust low digit */
-				setFlag(HalfFlag, (temp > 9));
-				acu += 6;
+			else {			/* last operation was an add */
+				if (testFlag(HalfFlag) || (temp > 9)) { /* adjust low digit */
+					setFlag(HalfFlag, (temp > 9));
+					acu += 6;
+				}
+				if (cbits || ((acu & 0x1f0) > 0x90)) /* adjust high digit */
+					acu += 0x60;
 			}
-			if (cbits || ((acu & 0x1f0) > 0x90)) /* adjust high digit */
-				acu += 0x60;
-		}
-		cbits |= (acu >> 8) & 1;
-		acu &= 0xff;
-		AF = (acu << 8) | (acu & 0xa8) | ((acu == 0) << 6) |
-			(AF & 0x12) | parity(acu) | cbits;
-		break;
-	case 0x28:			/* JR Z,dd */
-		PC += (testFlag(ZeroFlag)) ? (signed char) readRam(PC) + 1 : 1;
-		break;
-	case 0x29:			/* ADD HL,HL */
-		HL &= 0xffff;
-		sum = HL + HL;
-		cbits = (HL ^ HL ^ sum) >> 8;
-		HL = sum;
-		AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0x2A:			/* LD HL,(nnnn) */
-		temp = readWord(PC);
-		HL = readWord(temp);
-		PC += 2;
-		break;
-	case 0x2B:			/* DEC HL */
-		--HL;
-		break;
-	case 0x2C:			/* INC L */
-		temp = lowReg(HL)+1;
-		SetlowReg(HL, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x2D:			/* DEC L */
-		temp = lowReg(HL)-1;
-		SetlowReg(HL, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x2E:			/* LD L,nn */
-		SetlowReg(HL, readRam(PC)); ++PC;
-		break;
-	case 0x2F:			/* CPL */
-		AF = (~AF & ~0xff) | (AF & 0xc5) | ((~AF >> 8) & 0x28) | 0x12;
-		break;
-	case 0x30:			/* JR NC,dd */
-		PC += (!testFlag(CarryFlag)) ? (signed char) readRam(PC) + 1 : 1;
-		break;
-	case 0x31:			/* LD SP,nnnn */
-		SP = readWord(PC);
-		PC += 2;
-		break;
-	case 0x32:			/* LD (nnnn),A */
-		temp = readWord(PC);
-		writeRam(temp, highReg(AF));
-		PC += 2;
-		break;
-	case 0x33:			/* INC SP */
-		++SP;
-		break;
-	case 0x34:			/* INC (HL) */
-		temp = readRam(HL)+1;
-		writeRam(HL, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x35:			/* DEC (HL) */
-		temp = readRam(HL)-1;
-		writeRam(HL, temp);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x36:			/* LD (HL),nn */
-		writeRam(HL, readRam(PC)); ++PC;
-		break;
-	case 0x37:			/* SCF */
-		AF = (AF&~0x3b)|((AF>>8)&0x28)|1;
-		break;
-	case 0x38:			/* JR C,dd */
-		PC += (testFlag(CarryFlag)) ? (signed char) readRam(PC) + 1 : 1;
-		break;
-	case 0x39:			/* ADD HL,SP */
-		HL &= 0xffff;
-		SP &= 0xffff;
-		sum = HL + SP;
-		cbits = (HL ^ SP ^ sum) >> 8;
-		HL = sum;
-		AF = (AF & ~0x3b) | ((sum >> 8) & 0x28) |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0x3A:			/* LD A,(nnnn) */
-		temp = readWord(PC);
-		SethighReg(AF, readRam(temp));
-		PC += 2;
-		break;
-	case 0x3B:			/* DEC SP */
-		--SP;
-		break;
-	case 0x3C:			/* INC A */
-		AF += 0x100;
-		temp = highReg(AF);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0) << 4) |
-			((temp == 0x80) << 2);
-		break;
-	case 0x3D:			/* DEC A */
-		AF -= 0x100;
-		temp = highReg(AF);
-		AF = (AF & ~0xfe) | (temp & 0xa8) |
-			(((temp & 0xff) == 0) << 6) |
-			(((temp & 0xf) == 0xf) << 4) |
-			((temp == 0x7f) << 2) | 2;
-		break;
-	case 0x3E:			/* LD A,nn */
-		SethighReg(AF, readRam(PC)); ++PC;
-		break;
-	case 0x3F:			/* CCF */
-		AF = (AF&~0x3b)|((AF>>8)&0x28)|((AF&1)<<4)|(~AF&1);
-		break;
-	case 0x40:			/* LD B,B */
-		/* nop */
-		break;
-	case 0x41:			/* LD B,C */
-		BC = (BC & 255) | ((BC & 255) << 8);
-		break;
-	case 0x42:			/* LD B,D */
-		BC = (BC & 255) | (DE & ~255);
-		break;
-	case 0x43:			/* LD B,E */
-		BC = (BC & 255) | ((DE & 255) << 8);
-		break;
-	case 0x44:			/* LD B,H */
-		BC = (BC & 255) | (HL & ~255);
-		break;
-	case 0x45:			/* LD B,L */
-		BC = (BC & 255) | ((HL & 255) << 8);
-		break;
-	case 0x46:			/* LD B,(HL) */
-		SethighReg(BC, readRam(HL));
-		break;
-	case 0x47:			/* LD B,A */
-		BC = (BC & 255) | (AF & ~255);
-		break;
-	case 0x48:			/* LD C,B */
-		BC = (BC & ~255) | ((BC >> 8) & 255);
-		break;
-	case 0x49:			/* LD C,C */
-		/* nop */
-		break;
-	case 0x4A:			/* LD C,D */
-		BC = (BC & ~255) | ((DE >> 8) & 255);
-		break;
-	case 0x4B:			/* LD C,E */
-		BC = (BC & ~255) | (DE & 255);
-		break;
-	case 0x4C:			/* LD C,H */
-		BC = (BC & ~255) | ((HL >> 8) & 255);
-		break;
-	case 0x4D:			/* LD C,L */
-		BC = (BC & ~255) | (HL & 255);
-		break;
-	case 0x4E:			/* LD C,(HL) */
-		SetlowReg(BC, readRam(HL));
-		break;
-	case 0x4F:			/* LD C,A */
-		BC = (BC & ~255) | ((AF >> 8) & 255);
-		break;
-	case 0x50:			/* LD D,B */
-		DE = (DE & 255) | (BC & ~255);
-		break;
-	case 0x51:			/* LD D,C */
-		DE = (DE & 255) | ((BC & 255) << 8);
-		break;
-	case 0x52:			/* LD D,D */
-		/* nop */
-		break;
-	case 0x53:			/* LD D,E */
-		DE = (DE & 255) | ((DE & 255) << 8);
-		break;
-	case 0x54:			/* LD D,H */
-		DE = (DE & 255) | (HL & ~255);
-		break;
-	case 0x55:			/* LD D,L */
-		DE = (DE & 255) | ((HL & 255) << 8);
-		break;
-	case 0x56:			/* LD D,(HL) */
-		SethighReg(DE, readRam(HL));
-		break;
-	case 0x57:			/* LD D,A */
-		DE = (DE & 255) | (AF & ~255);
-		break;
-	case 0x58:			/* LD E,B */
-		DE = (DE & ~255) | ((BC >> 8) & 255);
-		break;
-	case 0x59:			/* LD E,C */
-		DE = (DE & ~255) | (BC & 255);
-		break;
-	case 0x5A:			/* LD E,D */
-		DE = (DE & ~255) | ((DE >> 8) & 255);
-		break;
-	case 0x5B:			/* LD E,E */
-		/* nop */
-		break;
-	case 0x5C:			/* LD E,H */
-		DE = (DE & ~255) | ((HL >> 8) & 255);
-		break;
-	case 0x5D:			/* LD E,L */
-		DE = (DE & ~255) | (HL & 255);
-		break;
-	case 0x5E:			/* LD E,(HL) */
-		SetlowReg(DE, readRam(HL));
-		break;
-	case 0x5F:			/* LD E,A */
-		DE = (DE & ~255) | ((AF >> 8) & 255);
-		break;
-	case 0x60:			/* LD H,B */
-		HL = (HL & 255) | (BC & ~255);
-		break;
-	case 0x61:			/* LD H,C */
-		HL = (HL & 255) | ((BC & 255) << 8);
-		break;
-	case 0x62:			/* LD H,D */
-		HL = (HL & 255) | (DE & ~255);
-		break;
-	case 0x63:			/* LD H,E */
-		HL = (HL & 255) | ((DE & 255) << 8);
-		break;
-	case 0x64:			/* LD H,H */
-		/* nop */
-		break;
-	case 0x65:			/* LD H,L */
-		HL = (HL & 255) | ((HL & 255) << 8);
-		break;
-	case 0x66:			/* LD H,(HL) */
-		SethighReg(HL, readRam(HL));
-		break;
-	case 0x67:			/* LD H,A */
-		HL = (HL & 255) | (AF & ~255);
-		break;
-	case 0x68:			/* LD L,B */
-		HL = (HL & ~255) | ((BC >> 8) & 255);
-		break;
-	case 0x69:			/* LD L,C */
-		HL = (HL & ~255) | (BC & 255);
-		break;
-	case 0x6A:			/* LD L,D */
-		HL = (HL & ~255) | ((DE >> 8) & 255);
-		break;
-	case 0x6B:			/* LD L,E */
-		HL = (HL & ~255) | (DE & 255);
-		break;
-	case 0x6C:			/* LD L,H */
-		HL = (HL & ~255) | ((HL >> 8) & 255);
-		break;
-	case 0x6D:			/* LD L,L */
-		/* nop */
-		break;
-	case 0x6E:			/* LD L,(HL) */
-		SetlowReg(HL, readRam(HL));
-		break;
-	case 0x6F:			/* LD L,A */
-		HL = (HL & ~255) | ((AF >> 8) & 255);
-		break;
-	case 0x70:			/* LD (HL),B */
-		writeRam(HL, highReg(BC));
-		break;
-	case 0x71:			/* LD (HL),C */
-		writeRam(HL, lowReg(BC));
-		break;
-	case 0x72:			/* LD (HL),D */
-		writeRam(HL, highReg(DE));
-		break;
-	case 0x73:			/* LD (HL),E */
-		writeRam(HL, lowReg(DE));
-		break;
-	case 0x74:			/* LD (HL),H */
-		writeRam(HL, highReg(HL));
-		break;
-	case 0x75:			/* LD (HL),L */
-		writeRam(HL, lowReg(HL));
-		break;
-	case 0x76:			/* HALT */
-		return;
-	case 0x77:			/* LD (HL),A */
-		writeRam(HL, highReg(AF));
-		break;
-	case 0x78:			/* LD A,B */
-		AF = (AF & 255) | (BC & ~255);
-		break;
-	case 0x79:			/* LD A,C */
-		AF = (AF & 255) | ((BC & 255) << 8);
-		break;
-	case 0x7A:			/* LD A,D */
-		AF = (AF & 255) | (DE & ~255);
-		break;
-	case 0x7B:			/* LD A,E */
-		AF = (AF & 255) | ((DE & 255) << 8);
-		break;
-	case 0x7C:			/* LD A,H */
-		AF = (AF & 255) | (HL & ~255);
-		break;
-	case 0x7D:			/* LD A,L */
-		AF = (AF & 255) | ((HL & 255) << 8);
-		break;
-	case 0x7E:			/* LD A,(HL) */
-		SethighReg(AF, readRam(HL));
-		break;
-	case 0x7F:			/* LD A,A */
-		/* nop */
-		break;
-	case 0x80:			/* ADD A,B */
-		temp = highReg(BC);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x81:			/* ADD A,C */
-		temp = lowReg(BC);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x82:			/* ADD A,D */
-		temp = highReg(DE);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x83:			/* ADD A,E */
-		temp = lowReg(DE);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x84:			/* ADD A,H */
-		temp = highReg(HL);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x85:			/* ADD A,L */
-		temp = lowReg(HL);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x86:			/* ADD A,(HL) */
-		temp = readRam(HL);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x87:			/* ADD A,A */
-		temp = highReg(AF);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x88:			/* ADC A,B */
-		temp = highReg(BC);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x89:			/* ADC A,C */
-		temp = lowReg(BC);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x8A:			/* ADC A,D */
-		temp = highReg(DE);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x8B:			/* ADC A,E */
-		temp = lowReg(DE);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x8C:			/* ADC A,H */
-		temp = highReg(HL);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x8D:			/* ADC A,L */
-		temp = lowReg(HL);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x8E:			/* ADC A,(HL) */
-		temp = readRam(HL);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x8F:			/* ADC A,A */
-		temp = highReg(AF);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		break;
-	case 0x90:			/* SUB B */
-		temp = highReg(BC);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x91:			/* SUB C */
-		temp = lowReg(BC);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x92:			/* SUB D */
-		temp = highReg(DE);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x93:			/* SUB E */
-		temp = lowReg(DE);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x94:			/* SUB H */
-		temp = highReg(HL);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x95:			/* SUB L */
-		temp = lowReg(HL);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x96:			/* SUB (HL) */
-		temp = readRam(HL);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x97:			/* SUB A */
-		temp = highReg(AF);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x98:			/* SBC A,B */
-		temp = highReg(BC);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x99:			/* SBC A,C */
-		temp = lowReg(BC);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x9A:			/* SBC A,D */
-		temp = highReg(DE);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x9B:			/* SBC A,E */
-		temp = lowReg(DE);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x9C:			/* SBC A,H */
-		temp = highReg(HL);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x9D:			/* SBC A,L */
-		temp = lowReg(HL);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x9E:			/* SBC A,(HL) */
-		temp = readRam(HL);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0x9F:			/* SBC A,A */
-		temp = highReg(AF);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		break;
-	case 0xA0:			/* AND B */
-		sum = ((AF & (BC)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) |
-			((sum == 0) << 6) | 0x10 | parity(sum);
-		break;
-	case 0xA1:			/* AND C */
-		sum = ((AF >> 8) & BC) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-			((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xA2:			/* AND D */
-		sum = ((AF & (DE)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) |
-			((sum == 0) << 6) | 0x10 | parity(sum);
-		break;
-	case 0xA3:			/* AND E */
-		sum = ((AF >> 8) & DE) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-			((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xA4:			/* AND H */
-		sum = ((AF & (HL)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) |
-			((sum == 0) << 6) | 0x10 | parity(sum);
-		break;
-	case 0xA5:			/* AND L */
-		sum = ((AF >> 8) & HL) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-			((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xA6:			/* AND (HL) */
-		sum = ((AF >> 8) & readRam(HL)) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-			((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xA7:			/* AND A */
-		sum = ((AF & (AF)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) |
-			((sum == 0) << 6) | 0x10 | parity(sum);
-		break;
-	case 0xA8:			/* XOR B */
-		sum = ((AF ^ (BC)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xA9:			/* XOR C */
-		sum = ((AF >> 8) ^ BC) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xAA:			/* XOR D */
-		sum = ((AF ^ (DE)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xAB:			/* XOR E */
-		sum = ((AF >> 8) ^ DE) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xAC:			/* XOR H */
-		sum = ((AF ^ (HL)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xAD:			/* XOR L */
-		sum = ((AF >> 8) ^ HL) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xAE:			/* XOR (HL) */
-		sum = ((AF >> 8) ^ readRam(HL)) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xAF:			/* XOR A */
-		sum = ((AF ^ (AF)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB0:			/* OR B */
-		sum = ((AF | (BC)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB1:			/* OR C */
-		sum = ((AF >> 8) | BC) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB2:			/* OR D */
-		sum = ((AF | (DE)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB3:			/* OR E */
-		sum = ((AF >> 8) | DE) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB4:			/* OR H */
-		sum = ((AF | (HL)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB5:			/* OR L */
-		sum = ((AF >> 8) | HL) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB6:			/* OR (HL) */
-		sum = ((AF >> 8) | readRam(HL)) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB7:			/* OR A */
-		sum = ((AF | (AF)) >> 8) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		break;
-	case 0xB8:			/* CP B */
-		temp = highReg(BC);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xB9:			/* CP C */
-		temp = lowReg(BC);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xBA:			/* CP D */
-		temp = highReg(DE);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xBB:			/* CP E */
-		temp = lowReg(DE);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xBC:			/* CP H */
-		temp = highReg(HL);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xBD:			/* CP L */
-		temp = lowReg(HL);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xBE:			/* CP (HL) */
-		temp = readRam(HL);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xBF:			/* CP A */
-		temp = highReg(AF);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		break;
-	case 0xC0:			/* RET NZ */
-		if (!testFlag(ZeroFlag)) PC = pop();
-		break;
-	case 0xC1:			/* pop BC */
-		BC = pop();
-		break;
-	case 0xC2:			/* JP NZ,nnnn */
-		conditionalJump(!testFlag(ZeroFlag));
-		break;
-	case 0xC3:			/* JP nnnn */
-		conditionalJump(true);
-		break;
-	case 0xC4:			/* CALL NZ,nnnn */
-		conditionalCall(!testFlag(ZeroFlag));
-		break;
-	case 0xC5:			/* push BC */
-		push(BC);
-		break;
-	case 0xC6:			/* ADD A,nn */
-		temp = readRam(PC);
-		acu = highReg(AF);
-		sum = acu + temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		++PC;
-		break;
-	case 0xC7:			/* RST 0 */
-		push(PC); PC = 0;
-		break;
-	case 0xC8:			/* RET Z */
-		if (testFlag(ZeroFlag)) PC= pop();
-		break;
-	case 0xC9:			/* RET */
-		PC = pop();
-		break;
-	case 0xCA:			/* JP Z,nnnn */
-		conditionalJump(testFlag(ZeroFlag));
-		break;
-	case 0xCB:			/* CB prefix */
-		cb_prefix(HL);
-		break;
-	case 0xCC:			/* CALL Z,nnnn */
-		conditionalCall(testFlag(ZeroFlag));
-		break;
-	case 0xCD:			/* CALL nnnn */
-		conditionalCall(true);
-		break;
-	case 0xCE:			/* ADC A,nn */
-		temp = readRam(PC);
-		acu = highReg(AF);
-		sum = acu + temp + testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-			((cbits >> 8) & 1);
-		++PC;
-		break;
-	case 0xCF:			/* RST 8 */
-		push(PC); PC = 8;
-		break;
-	case 0xD0:			/* RET NC */
-		if (!testFlag(CarryFlag)) PC = pop();
-		break;
-	case 0xD1:			/* pop DE */
-		DE = pop();
-		break;
-	case 0xD2:			/* JP NC,nnnn */
-		conditionalJump(!testFlag(CarryFlag));
-		break;
-	case 0xD3:			/* OUT (nn),A */
-		portOut(readRam(PC), highReg(AF)); ++PC;
-		break;
-	case 0xD4:			/* CALL NC,nnnn */
-		conditionalCall(!testFlag(CarryFlag));
-		break;
-	case 0xD5:			/* push DE */
-		push(DE);
-		break;
-	case 0xD6:			/* SUB nn */
-		temp = readRam(PC);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		++PC;
-		break;
-	case 0xD7:			/* RST 10H */
-		push(PC); PC = 0x10;
-		break;
-	case 0xD8:			/* RET C */
-		if (testFlag(CarryFlag)) PC = pop();
-		break;
-	case 0xD9:			/* EXX */
-		swap(BC, BCalt);
-		swap(DE, DEalt);
-		swap(HL, HLalt);
-		break;
-	case 0xDA:			/* JP C,nnnn */
-		conditionalJump(testFlag(CarryFlag));
-		break;
-	case 0xDB:			/* IN A,(nn) */
-		SethighReg(AF, portIn(readRam(PC))); ++PC;
-		break;
-	case 0xDC:			/* CALL C,nnnn */
-		conditionalCall(testFlag(CarryFlag));
-		break;
-	case 0xDD:			/* DD prefix */
-		ix = dfd_prefix(ix);
-		break;
-	case 0xDE:			/* SBC A,nn */
-		temp = readRam(PC);
-		acu = highReg(AF);
-		sum = acu - temp - testFlag(CarryFlag);
-		cbits = acu ^ temp ^ sum;
-		AF = ((sum & 0xff) << 8) | (sum & 0xa8) |
-			(((sum & 0xff) == 0) << 6) | (cbits & 0x10) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			((cbits >> 8) & 1);
-		++PC;
-		break;
-	case 0xDF:			/* RST 18H */
-		push(PC); PC = 0x18;
-		break;
-	case 0xE0:			/* RET PO */
-		if (!testFlag(ParityFlag)) PC = pop();
-		break;
-	case 0xE1:			/* pop HL */
-		HL = pop();
-		break;
-	case 0xE2:			/* JP PO,nnnn */
-		conditionalJump(!testFlag(ParityFlag));
-		break;
-	case 0xE3:			/* EX (SP),HL */
-		temp = HL; HL = pop(); push(temp);
-		break;
-	case 0xE4:			/* CALL PO,nnnn */
-		conditionalCall(!testFlag(ParityFlag));
-		break;
-	case 0xE5:			/* push HL */
-		push(HL);
-		break;
-	case 0xE6:			/* AND nn */
-		sum = ((AF >> 8) & readRam(PC)) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | 0x10 |
-			((sum == 0) << 6) | parity(sum);
-		++PC;
-		break;
-	case 0xE7:			/* RST 20H */
-		push(PC); PC = 0x20;
-		break;
-	case 0xE8:			/* RET PE */
-		if (testFlag(ParityFlag)) PC = pop();
-		break;
-	case 0xE9:			/* JP (HL) */
-		PC = HL;
-		break;
-	case 0xEA:			/* JP PE,nnnn */
-		conditionalJump(testFlag(ParityFlag));
-		break;
-	case 0xEB:			/* EX DE,HL */
-		temp = HL; HL = DE; DE = temp;
-		break;
-	case 0xEC:			/* CALL PE,nnnn */
-		conditionalCall(testFlag(ParityFlag));
-		break;
-	case 0xED:			/* ED prefix */
-		switch (++PC, op = readRam(PC-1)) {
-		case 0x40:			/* IN B,(C) */
-			temp = portIn(lowReg(BC));
-			SethighReg(BC, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x41:			/* OUT (C),B */
-			portOut(lowReg(BC), BC);
-			break;
-		case 0x42:			/* SBC HL,BC */
-			HL &= 0xffff;
-			BC &= 0xffff;
-			sum = HL - BC - testFlag(CarryFlag);
-			cbits = (HL ^ BC ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
-			break;
-		case 0x43:			/* LD (nnnn),BC */
-			temp = readWord(PC);
-			writeWord(temp, BC);
-			PC += 2;
+			cbits |= (acu >> 8) & 1;
+			acu &= 0xff;
+			reg.af.word = (acu << 8) | (acu & 0xa8) | ((acu == 0) << 6) |
+				(reg.af.word & 0x12) | parity(acu) | cbits;
 			break;
-		case 0x44:			/* NEG */
-			temp = highReg(AF);
-			AF = (-(AF & 0xff00) & 0xff00);
-			AF |= ((AF >> 8) & 0xa8) | (((AF & 0xff00) == 0) << 6) |
-				(((temp & 0x0f) != 0) << 4) | ((temp == 0x80) << 2) |
-				2 | (temp != 0);
+		case 0x2A:			/* LD HL,(nnnn) */
+			temp = readWord(reg.pc);
+			hl.word = readWord(temp);
+			reg.pc += 2;
 			break;
-		case 0x45:			/* RETN */
-			IFF |= IFF >> 1;
-			PC = pop();
+		case 0x2F:			/* CPL */
+			resolveFlags();
+			reg.af.word = (~reg.af.word & ~0xff) | (reg.af.word & 0xc5) | ((~reg.af.word >> 8) & 0x28) | 0x12;
 			break;
-		case 0x46:			/* IM 0 */
-			/* interrupt mode 0 */
+		case 0x32:			/* LD (nnnn),A */
+			temp = readWord(reg.pc);
+			writeRam(temp, reg.af.high);
+			reg.pc += 2;
 			break;
-		case 0x47:			/* LD I,A */
-			ir = (ir & 255) | (AF & ~255);
+		case 0x37:			/* SCF */
+			resolveFlags();
+			reg.af.word = (reg.af.word&~0x3b)|((reg.af.word>>8)&0x28)|1;
 			break;
-		case 0x48:			/* IN C,(C) */
-			temp = portIn(lowReg(BC));
-			SetlowReg(BC, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
+		case 0x3A:			/* LD A,(nnnn) */
+			temp = readWord(reg.pc);
+			reg.af.high = readRam(temp);
+			reg.pc += 2;
 			break;
-		case 0x49:			/* OUT (C),C */
-			portOut(lowReg(BC), BC);
+		case 0x3F:			/* CCF */
+			resolveFlags();
+			reg.af.word = (reg.af.word&~0x3b)|((reg.af.word>>8)&0x28)|((reg.af.word&1)<<4)|(~reg.af.word&1);
 			break;
-		case 0x4A:			/* ADC HL,BC */
-			HL &= 0xffff;
-			BC &= 0xffff;
-			sum = HL + BC + testFlag(CarryFlag);
-			cbits = (HL ^ BC ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
+		case 0x76:			/* HALT */
+			pending |= Halted;
 			break;
-		case 0x4B:			/* LD BC,(nnnn) */
-			temp = readWord(PC);
-			BC = readWord(temp);
-			PC += 2;
+		case 0xC3:			/* JP nnnn */
+			conditionalJump(true);
 			break;
-		case 0x4D:			/* RETI */
-			IFF |= IFF >> 1;
-			PC = pop();
+		case 0xC9:			/* RET */
+			reg.pc = pop();
 			break;
-		case 0x4F:			/* LD R,A */
-			ir = (ir & ~255) | ((AF >> 8) & 255);
-			break;
-		case 0x50:			/* IN D,(C) */
-			temp = portIn(lowReg(BC));
-			SethighReg(DE, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x51:			/* OUT (C),D */
-			portOut(lowReg(BC), DE);
-			break;
-		case 0x52:			/* SBC HL,DE */
-			HL &= 0xffff;
-			DE &= 0xffff;
-			sum = HL - DE - testFlag(CarryFlag);
-			cbits = (HL ^ DE ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
-			break;
-		case 0x53:			/* LD (nnnn),DE */
-			temp = readWord(PC);
-			writeWord(temp, DE);
-			PC += 2;
-			break;
-		case 0x56:			/* IM 1 */
-			/* interrupt mode 1 */
-			break;
-		case 0x57:			/* LD A,I */
-			AF = (AF & 0x29) | (ir & ~255) | ((ir >> 8) & 0x80) | (((ir & ~255) == 0) << 6) | ((IFF & 2) << 1);
-			break;
-		case 0x58:			/* IN E,(C) */
-			temp = portIn(lowReg(BC));
-			SetlowReg(DE, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x59:			/* OUT (C),E */
-			portOut(lowReg(BC), DE);
-			break;
-		case 0x5A:			/* ADC HL,DE */
-			HL &= 0xffff;
-			DE &= 0xffff;
-			sum = HL + DE + testFlag(CarryFlag);
-			cbits = (HL ^ DE ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x5B:			/* LD DE,(nnnn) */
-			temp = readWord(PC);
-			DE = readWord(temp);
-			PC += 2;
-			break;
-		case 0x5E:			/* IM 2 */
-			/* interrupt mode 2 */
-			break;
-		case 0x5F:			/* LD A,R */
-			AF = (AF & 0x29) | ((ir & 255) << 8) | (ir & 0x80) | (((ir & 255) == 0) << 6) | ((IFF & 2) << 1);
-			break;
-		case 0x60:			/* IN H,(C) */
-			temp = portIn(lowReg(BC));
-			SethighReg(HL, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x61:			/* OUT (C),H */
-			portOut(lowReg(BC), HL);
-			break;
-		case 0x62:			/* SBC HL,HL */
-			HL &= 0xffff;
-			sum = HL - HL - testFlag(CarryFlag);
-			cbits = (HL ^ HL ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
-			break;
-		case 0x63:			/* LD (nnnn),HL */
-			temp = readWord(PC);
-			writeWord(temp, HL);
-			PC += 2;
-			break;
-		case 0x67:			/* RRD */
-			temp = readRam(HL);
-			acu = highReg(AF);
-			writeRam(HL, highDigit(temp) | (lowDigit(acu) << 4));
-			acu = (acu & 0xf0) | lowDigit(temp);
-			AF = (acu << 8) | (acu & 0xa8) | (((acu & 0xff) == 0) << 6) |
-				parity(acu) | (AF & 1);
-			break;
-		case 0x68:			/* IN L,(C) */
-			temp = portIn(lowReg(BC));
-			SetlowReg(HL, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x69:			/* OUT (C),L */
-			portOut(lowReg(BC), HL);
-			break;
-		case 0x6A:			/* ADC HL,HL */
-			HL &= 0xffff;
-			sum = HL + HL + testFlag(CarryFlag);
-			cbits = (HL ^ HL ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x6B:			/* LD HL,(nnnn) */
-			temp = readWord(PC);
-			HL = readWord(temp);
-			PC += 2;
-			break;
-		case 0x6F:			/* RLD */
-			temp = readRam(HL);
-			acu = highReg(AF);
-			writeRam(HL, (lowDigit(temp) << 4) | lowDigit(acu));
-			acu = (acu & 0xf0) | highDigit(temp);
-			AF = (acu << 8) | (acu & 0xa8) | (((acu & 0xff) == 0) << 6) |
-				parity(acu) | (AF & 1);
-			break;
-		case 0x70:			/* IN (C) */
-			temp = portIn(lowReg(BC));
-			SetlowReg(temp, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x71:			/* OUT (C),0 */
-			portOut(lowReg(BC), 0);
-			break;
-		case 0x72:			/* SBC HL,SP */
-			HL &= 0xffff;
-			SP &= 0xffff;
-			sum = HL - SP - testFlag(CarryFlag);
-			cbits = (HL ^ SP ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
-			break;
-		case 0x73:			/* LD (nnnn),SP */
-			temp = readWord(PC);
-			writeWord(temp, SP);
-			PC += 2;
-			break;
-		case 0x78:			/* IN A,(C) */
-			temp = portIn(lowReg(BC));
-			SethighReg(AF, temp);
-			AF = (AF & ~0xfe) | (temp & 0xa8) |
-				(((temp & 0xff) == 0) << 6) |
-				parity(temp);
-			break;
-		case 0x79:			/* OUT (C),A */
-			portOut(lowReg(BC), AF);
-			break;
-		case 0x7A:			/* ADC HL,SP */
-			HL &= 0xffff;
-			SP &= 0xffff;
-			sum = HL + SP + testFlag(CarryFlag);
-			cbits = (HL ^ SP ^ sum) >> 8;
-			HL = sum;
-			AF = (AF & ~0xff) | ((sum >> 8) & 0xa8) |
-				(((sum & 0xffff) == 0) << 6) |
-				(((cbits >> 6) ^ (cbits >> 5)) & 4) |
-				(cbits & 0x10) | ((cbits >> 8) & 1);
-			break;
-		case 0x7B:			/* LD SP,(nnnn) */
-			temp = readWord(PC);
-			SP = readWord(temp);
-			PC += 2;
-			break;
-		case 0xA0:			/* LDI */
-			acu = readRam(HL); ++HL;
-			writeRam(DE, acu); ++DE;
-			acu += highReg(AF);
-			AF = (AF & ~0x3e) | (acu & 8) | ((acu & 2) << 4) |
-				(((--BC & 0xffff) != 0) << 2);
+		case 0xCB:			/* CB prefix */
+			temp = memoryOperand<Index>();
+			cycles += bitCycles(readRam(reg.pc), Index != UseHL);
+			cb_prefix(temp);
 			break;
-		case 0xA1:			/* CPI */
-			acu = highReg(AF);
-			temp = readRam(HL); ++HL;
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
-				(((sum - ((cbits&16)>>4))&2) << 4) | (cbits & 16) |
-				((sum - ((cbits >> 4) & 1)) & 8) |
-				((--BC & 0xffff) != 0) << 2 | 2;
-			if ((sum & 15) == 8 && (cbits & 16) != 0)
-				AF &= ~8;
+		case 0xCD:			/* CALL nnnn */
+			conditionalCall(true);
 			break;
-		case 0xA2:			/* INI */
-			writeRam(HL, portIn(lowReg(BC))); ++HL;
-			setFlag(SubFlag, 1);
-			setFlag(ParityFlag, (--BC & 0xffff) != 0);
+		case 0xD3:			/* OUT (nn),A */
+			portOut(readRam(reg.pc), reg.af.high); ++reg.pc;
 			break;
-		case 0xA3:			/* OUTI */
-			portOut(lowReg(BC), readRam(HL)); ++HL;
-			setFlag(SubFlag, 1);
-			SethighReg(BC, lowReg(BC) - 1);
-			setFlag(ZeroFlag, lowReg(BC) == 0);
+		case 0xD9:			/* EXX */
+			swap(reg.bc, reg.bcAlt);
+			swap(reg.de, reg.deAlt);
+			swap(reg.hl, reg.hlAlt);
 			break;
-		case 0xA8:			/* LDD */
-			acu = readRam(HL); --HL;
-			writeRam(DE, acu); --DE;
-			acu += highReg(AF);
-			AF = (AF & ~0x3e) | (acu & 8) | ((acu & 2) << 4) |
-				(((--BC & 0xffff) != 0) << 2);
+		case 0xDB:			/* IN A,(nn) */
+			reg.af.high = portIn(readRam(reg.pc)); ++reg.pc;
 			break;
-		case 0xA9:			/* CPD */
-			acu = highReg(AF);
-			temp = readRam(HL); --HL;
-			sum = acu - temp;
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
-				(((sum - ((cbits&16)>>4))&2) << 4) | (cbits & 16) |
-				((sum - ((cbits >> 4) & 1)) & 8) |
-				((--BC & 0xffff) != 0) << 2 | 2;
-			if ((sum & 15) == 8 && (cbits & 16) != 0)
-				AF &= ~8;
+		case 0xDD:			/* DD prefix */
+			indexedOp<UseIX>();
 			break;
-		case 0xAA:			/* IND */
-			writeRam(HL, portIn(lowReg(BC))); --HL;
-			setFlag(SubFlag, 1);
-			SethighReg(BC, lowReg(BC) - 1);
-			setFlag(ZeroFlag, lowReg(BC) == 0);
+		case 0xE3:			/* EX (SP),HL */
+			temp = hl.word; hl.word = pop(); push(temp);
 			break;
-		case 0xAB:			/* OUTD */
-			portOut(lowReg(BC), readRam(HL)); --HL;
-			setFlag(SubFlag, 1);
-			SethighReg(BC, lowReg(BC) - 1);
-			setFlag(ZeroFlag, lowReg(BC) == 0);
+		case 0xE9:			/* JP (HL) */
+			reg.pc = hl.word;
 			break;
-		case 0xB0:			/* LDIR */
-			acu = highReg(AF);
-			BC &= 0xffff;
-			do {
-				acu = readRam(HL); ++HL;
-				writeRam(DE, acu); ++DE;
-			} while (--BC);
-			acu += highReg(AF);
-			AF = (AF & ~0x3e) | (acu & 8) | ((acu & 2) << 4);
+		case 0xEB:			/* EX DE,HL */
+			temp = reg.hl.word; reg.hl.word = reg.de.word; reg.de.word = temp;
 			break;
-		case 0xB1:			/* CPIR */
-			acu = highReg(AF);
-			BC &= 0xffff;
-			do {
-				temp = readRam(HL); ++HL;
-				op = --BC != 0;
+		case 0xED:			/* ED prefix */
+			op = readRam(reg.pc); ++reg.pc;
+			cycles += extendedCycles[op];
+			resolveFlags();
+
+			switch (op) {
+			case 0x40:			/* IN B,(C) */
+				temp = portIn(reg.bc.low);
+				reg.bc.high = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x41:			/* OUT (C),B */
+				portOut(reg.bc.low, reg.bc.high);
+				break;
+			case 0x42:			/* SBC HL,BC */
+				sum = reg.hl.word - reg.bc.word - testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.bc.word ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
+				break;
+			case 0x43:			/* LD (nnnn),BC */
+				temp = readWord(reg.pc);
+				writeWord(temp, reg.bc.word);
+				reg.pc += 2;
+				break;
+			case 0x44:			/* NEG */
+				temp = reg.af.high;
+				reg.af.word = (-(reg.af.word & 0xff00) & 0xff00);
+				reg.af.word |= ((reg.af.word >> 8) & 0xa8) | (((reg.af.word & 0xff00) == 0) << 6) |
+					(((temp & 0x0f) != 0) << 4) | ((temp == 0x80) << 2) |
+					2 | (temp != 0);
+				break;
+			case 0x45:			/* RETN */
+				reg.iff |= reg.iff >> 1;
+				reg.pc = pop();
+				break;
+			case 0x46:			/* IM 0 */
+				reg.im = 0;
+				break;
+			case 0x47:			/* LD I,A */
+				reg.ir.high = reg.af.high;
+				break;
+			case 0x48:			/* IN C,(C) */
+				temp = portIn(reg.bc.low);
+				reg.bc.low = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x49:			/* OUT (C),C */
+				portOut(reg.bc.low, reg.bc.word);
+				break;
+			case 0x4A:			/* ADC HL,BC */
+				sum = reg.hl.word + reg.bc.word + testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.bc.word ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | ((cbits >> 8) & 1);
+				break;
+			case 0x4B:			/* LD BC,(nnnn) */
+				temp = readWord(reg.pc);
+				reg.bc.word = readWord(temp);
+				reg.pc += 2;
+				break;
+			case 0x4D:			/* RETI */
+				reg.iff |= reg.iff >> 1;
+				reg.pc = pop();
+				break;
+			case 0x4F:			/* LD R,A */
+				reg.ir.low = reg.af.high;
+				break;
+			case 0x50:			/* IN D,(C) */
+				temp = portIn(reg.bc.low);
+				reg.de.high = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x51:			/* OUT (C),D */
+				portOut(reg.bc.low, reg.de.high);
+				break;
+			case 0x52:			/* SBC HL,DE */
+				sum = reg.hl.word - reg.de.word - testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.de.word ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
+				break;
+			case 0x53:			/* LD (nnnn),DE */
+				temp = readWord(reg.pc);
+				writeWord(temp, reg.de.word);
+				reg.pc += 2;
+				break;
+			case 0x56:			/* IM 1 */
+				reg.im = 1;
+				break;
+			case 0x57:			/* LD A,I */
+				reg.af.high = reg.ir.high;
+				reg.af.low = (reg.af.low & 0x29) | (reg.ir.high & 0x80) | ((reg.ir.high == 0) << 6) | ((reg.iff & 2) << 1);
+				break;
+			case 0x58:			/* IN E,(C) */
+				temp = portIn(reg.bc.low);
+				reg.de.low = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x59:			/* OUT (C),E */
+				portOut(reg.bc.low, reg.de.word);
+				break;
+			case 0x5A:			/* ADC HL,DE */
+				sum = reg.hl.word + reg.de.word + testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.de.word ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | ((cbits >> 8) & 1);
+				break;
+			case 0x5B:			/* LD DE,(nnnn) */
+				temp = readWord(reg.pc);
+				reg.de.word = readWord(temp);
+				reg.pc += 2;
+				break;
+			case 0x5E:			/* IM 2 */
+				reg.im = 2;
+				break;
+			case 0x5F:			/* LD A,R */
+				reg.af.high = reg.ir.low;
+				reg.af.low = (reg.af.low & 0x29) | (reg.ir.low & 0x80) | ((reg.ir.low == 0) << 6) | ((reg.iff & 2) << 1);
+				break;
+			case 0x60:			/* IN H,(C) */
+				temp = portIn(reg.bc.low);
+				reg.hl.high = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x61:			/* OUT (C),H */
+				portOut(reg.bc.low, reg.hl.high);
+				break;
+			case 0x62:			/* SBC HL,HL */
+				sum = reg.hl.word - reg.hl.word - testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.hl.word ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
+				break;
+			case 0x63:			/* LD (nnnn),HL */
+				temp = readWord(reg.pc);
+				writeWord(temp, reg.hl.word);
+				reg.pc += 2;
+				break;
+			case 0x67:			/* RRD */
+				temp = readRam(reg.hl.word);
+				acu = reg.af.high;
+				writeRam(reg.hl.word, highDigit(temp) | (lowDigit(acu) << 4));
+				acu = (acu & 0xf0) | lowDigit(temp);
+				reg.af.word = (acu << 8) | (acu & 0xa8) | (((acu & 0xff) == 0) << 6) |
+					parity(acu) | (reg.af.word & 1);
+				break;
+			case 0x68:			/* IN L,(C) */
+				temp = portIn(reg.bc.low);
+				reg.hl.low = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x69:			/* OUT (C),L */
+				portOut(reg.bc.low, reg.hl.word);
+				break;
+			case 0x6A:			/* ADC HL,HL */
+				sum = reg.hl.word + reg.hl.word + testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.hl.word ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | ((cbits >> 8) & 1);
+				break;
+			case 0x6B:			/* LD HL,(nnnn) */
+				temp = readWord(reg.pc);
+				reg.hl.word = readWord(temp);
+				reg.pc += 2;
+				break;
+			case 0x6F:			/* RLD */
+				temp = readRam(reg.hl.word);
+				acu = reg.af.high;
+				writeRam(reg.hl.word, (lowDigit(temp) << 4) | lowDigit(acu));
+				acu = (acu & 0xf0) | highDigit(temp);
+				reg.af.word = (acu << 8) | (acu & 0xa8) | (((acu & 0xff) == 0) << 6) |
+					parity(acu) | (reg.af.word & 1);
+				break;
+			case 0x70:			/* IN (C) */
+				temp = portIn(reg.bc.low);
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x71:			/* OUT (C),0 */
+				portOut(reg.bc.low, 0);
+				break;
+			case 0x72:			/* SBC HL,SP */
+				sum = reg.hl.word - reg.sp - testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.sp ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | 2 | ((cbits >> 8) & 1);
+				break;
+			case 0x73:			/* LD (nnnn),SP */
+				temp = readWord(reg.pc);
+				writeWord(temp, reg.sp);
+				reg.pc += 2;
+				break;
+			case 0x78:			/* IN A,(C) */
+				temp = portIn(reg.bc.low);
+				reg.af.high = temp;
+				reg.af.word = (reg.af.word & ~0xfe) | (temp & 0xa8) |
+					(((temp & 0xff) == 0) << 6) |
+					parity(temp);
+				break;
+			case 0x79:			/* OUT (C),A */
+				portOut(reg.bc.low, reg.af.high);
+				break;
+			case 0x7A:			/* ADC HL,SP */
+				sum = reg.hl.word + reg.sp + testFlag(CarryFlag);
+				cbits = (reg.hl.word ^ reg.sp ^ sum) >> 8;
+				reg.hl.word = sum;
+				reg.af.word = (reg.af.word & ~0xff) | ((sum >> 8) & 0xa8) |
+					(((sum & 0xffff) == 0) << 6) |
+					(((cbits >> 6) ^ (cbits >> 5)) & 4) |
+					(cbits & 0x10) | ((cbits >> 8) & 1);
+				break;
+			case 0x7B:			/* LD SP,(nnnn) */
+				temp = readWord(reg.pc);
+				reg.sp = readWord(temp);
+				reg.pc += 2;
+				break;
+			case 0xA0:			/* LDI */
+				acu = readRam(reg.hl.word); ++reg.hl.word;
+				writeRam(reg.de.word, acu); ++reg.de.word;
+				acu += reg.af.high;
+				reg.af.word = (reg.af.word & ~0x3e) | (acu & 8) | ((acu & 2) << 4) |
+					(((--reg.bc.word & 0xffff) != 0) << 2);
+				break;
+			case 0xA1:			/* CPI */
+				acu = reg.af.high;
+				temp = readRam(reg.hl.word); ++reg.hl.word;
 				sum = acu - temp;
-			} while (op && sum != 0);
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
-				(((sum - ((cbits&16)>>4))&2) << 4) |
-				(cbits & 16) | ((sum - ((cbits >> 4) & 1)) & 8) |
-				op << 2 | 2;
-			if ((sum & 15) == 8 && (cbits & 16) != 0)
-				AF &= ~8;
-			break;
-		case 0xB2:			/* INIR */
-			temp = highReg(BC);
-			do {
-				writeRam(HL, portIn(lowReg(BC))); ++HL;
-			} while (--temp);
-			SethighReg(BC, 0);
-			setFlag(SubFlag, 1);
-			setFlag(ZeroFlag, 1);
-			break;
-		case 0xB3:			/* OTIR */
-			temp = highReg(BC);
-			do {
-				portOut(lowReg(BC), readRam(HL)); ++HL;
-			} while (--temp);
-			SethighReg(BC, 0);
-			setFlag(SubFlag, 1);
-			setFlag(ZeroFlag, 1);
+				cbits = acu ^ temp ^ sum;
+				reg.af.word = (reg.af.word & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
+					(((sum - ((cbits&16)>>4))&2) << 4) | (cbits & 16) |
+					((sum - ((cbits >> 4) & 1)) & 8) |
+					((--reg.bc.word & 0xffff) != 0) << 2 | 2;
+				if ((sum & 15) == 8 && (cbits & 16) != 0)
+					reg.af.word &= ~8;
+				break;
+			case 0xA2:			/* INI */
+				writeRam(reg.hl.word, portIn(reg.bc.low)); ++reg.hl.word;
+				setFlag(SubFlag, 1);
+				setFlag(ZeroFlag, --reg.bc.high == 0);
+				break;
+			case 0xA3:			/* OUTI */
+				portOut(reg.bc.low, readRam(reg.hl.word)); ++reg.hl.word;
+				setFlag(SubFlag, 1);
+				setFlag(ZeroFlag, --reg.bc.high == 0);
+				break;
+			case 0xA8:			/* LDD */
+				acu = readRam(reg.hl.word); --reg.hl.word;
+				writeRam(reg.de.word, acu); --reg.de.word;
+				acu += reg.af.high;
+				reg.af.word = (reg.af.word & ~0x3e) | (acu & 8) | ((acu & 2) << 4) |
+					(((--reg.bc.word & 0xffff) != 0) << 2);
+				break;
+			case 0xA9:			/* CPD */
+				acu = reg.af.high;
+				temp = readRam(reg.hl.word); --reg.hl.word;
+				sum = acu - temp;
+				cbits = acu ^ temp ^ sum;
+				reg.af.word = (reg.af.word & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
+					(((sum - ((cbits&16)>>4))&2) << 4) | (cbits & 16) |
+					((sum - ((cbits >> 4) & 1)) & 8) |
+					((--reg.bc.word & 0xffff) != 0) << 2 | 2;
+				if ((sum & 15) == 8 && (cbits & 16) != 0)
+					reg.af.word &= ~8;
+				break;
+			case 0xAA:			/* IND */
+				writeRam(reg.hl.word, portIn(reg.bc.low)); --reg.hl.word;
+				setFlag(SubFlag, 1);
+				setFlag(ZeroFlag, --reg.bc.high == 0);
+				break;
+			case 0xAB:			/* OUTD */
+				portOut(reg.bc.low, readRam(reg.hl.word)); --reg.hl.word;
+				setFlag(SubFlag, 1);
+				setFlag(ZeroFlag, --reg.bc.high == 0);
+				break;
+			case 0xB0:			/* LDIR */
+				repeatLoad(1);
+				break;
+			case 0xB1:			/* CPIR */
+				repeatCompare(1);
+				break;
+			case 0xB2:			/* INIR */
+				repeatIO(1, false);
+				break;
+			case 0xB3:			/* OTIR */
+				repeatIO(1, true);
+				break;
+			case 0xB8:			/* LDDR */
+				repeatLoad(-1);
+				break;
+			case 0xB9:			/* CPDR */
+				repeatCompare(-1);
+				break;
+			case 0xBA:			/* INDR */
+				repeatIO(-1, false);
+				break;
+			case 0xBB:			/* OTDR */
+				repeatIO(-1, true);
+				break;
+			default: if (0x40 <= op && op <= 0x7f) reg.pc--;		/* ignore ED */
+			}
 			break;
-		case 0xB8:			/* LDDR */
-			BC &= 0xffff;
-			do {
-				acu = readRam(HL); --HL;
-				writeRam(DE, acu); --DE;
-			} while (--BC);
-			acu += highReg(AF);
-			AF = (AF & ~0x3e) | (acu & 8) | ((acu & 2) << 4);
+		case 0xF3:			/* DI */
+			reg.iff = 0;
 			break;
-		case 0xB9:			/* CPDR */
-			acu = highReg(AF);
-			BC &= 0xffff;
-			do {
-				temp = readRam(HL); --HL;
-				op = --BC != 0;
-				sum = acu - temp;
-			} while (op && sum != 0);
-			cbits = acu ^ temp ^ sum;
-			AF = (AF & ~0xfe) | (sum & 0x80) | (!(sum & 0xff) << 6) |
-				(((sum - ((cbits&16)>>4))&2) << 4) |
-				(cbits & 16) | ((sum - ((cbits >> 4) & 1)) & 8) |
-				op << 2 | 2;
-			if ((sum & 15) == 8 && (cbits & 16) != 0)
-				AF &= ~8;
+		case 0xF9:			/* LD SP,HL */
+			reg.sp = hl.word;
 			break;
-		case 0xBA:			/* INDR */
-			temp = highReg(BC);
-			do {
-				writeRam(HL, portIn(lowReg(BC))); --HL;
-			} while (--temp);
-			SethighReg(BC, 0);
-			setFlag(SubFlag, 1);
-			setFlag(ZeroFlag, 1);
+		case 0xFB:			/* EI */
+			reg.iff = 3;
+			pending |= AfterEI;
 			break;
-		case 0xBB:			/* OTDR */
-			temp = highReg(BC);
-			do {
-				portOut(lowReg(BC), readRam(HL)); --HL;
-			} while (--temp);
-			SethighReg(BC, 0);
-			setFlag(SubFlag, 1);
-			setFlag(ZeroFlag, 1);
+		case 0xFD:			/* FD prefix */
+			indexedOp<UseIY>();
 			break;
-		default: if (0x40 <= op && op <= 0x7f) PC--;		/* ignore ED */
 		}
-		break;
-	case 0xEE:			/* XOR nn */
-		sum = ((AF >> 8) ^ readRam(PC)) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		++PC;
-		break;
-	case 0xEF:			/* RST 28H */
-		push(PC); PC = 0x28;
-		break;
-	case 0xF0:			/* RET P */
-		if (!testFlag(SignFlag)) PC = pop();
-		break;
-	case 0xF1:			/* pop AF */
-		AF = pop();
-		break;
-	case 0xF2:			/* JP P,nnnn */
-		conditionalJump(!testFlag(SignFlag));
-		break;
-	case 0xF3:			/* DI */
-		IFF = 0;
-		break;
-	case 0xF4:			/* CALL P,nnnn */
-		conditionalCall(!testFlag(SignFlag));
-		break;
-	case 0xF5:			/* push AF */
-		push(AF);
-		break;
-	case 0xF6:			/* OR nn */
-		sum = ((AF >> 8) | readRam(PC)) & 0xff;
-		AF = (sum << 8) | (sum & 0xa8) | ((sum == 0) << 6) | parity(sum);
-		++PC;
-		break;
-	case 0xF7:			/* RST 30H */
-		push(PC); PC = 0x30;
-		break;
-	case 0xF8:			/* RET M */
-		if (testFlag(SignFlag)) PC = pop();
-		break;
-	case 0xF9:			/* LD SP,HL */
-		SP = HL;
-		break;
-	case 0xFA:			/* JP M,nnnn */
-		conditionalJump(testFlag(SignFlag));
-		break;
-	case 0xFB:			/* EI */
-		IFF = 3;
-		break;
-	case 0xFC:			/* CALL M,nnnn */
-		conditionalCall(testFlag(SignFlag));
-		break;
-	case 0xFD:			/* FD prefix */
-		iy = dfd_prefix(iy);
-		break;
-	case 0xFE:			/* CP nn */
-		temp = readRam(PC);
-		AF = (AF & ~0x28) | (temp & 0x28);
-		acu = highReg(AF);
-		sum = acu - temp;
-		cbits = acu ^ temp ^ sum;
-		AF = (AF & ~0xff) | (sum & 0x80) |
-			(((sum & 0xff) == 0) << 6) | (temp & 0x28) |
-			(((cbits >> 6) ^ (cbits >> 5)) & 4) | 2 |
-			(cbits & 0x10) | ((cbits >> 8) & 1);
-		++PC;
-		break;
-	case 0xFF:			/* RST 38H */
-		push(PC); PC = 0x38;
-    }
+	}
+}
+
+
+// The dispatch tables, one mainOp<> for each opcode and each of HL, IX
+// and IY, filled in by the compiler
+
+typedef void (*OpHandler)();
+typedef std::array<OpHandler, 256> OpTable;
+
+template<int Index, std::size_t... Ops>
+constexpr OpTable makeHandlers(std::index_sequence<Ops...>)
+{
+	return {{ &mainOp<Ops, Index>... }};
+}
+
+static constexpr OpTable mainHandlers = makeHandlers<UseHL>(std::make_index_sequence<256>());
+static constexpr OpTable ixHandlers = makeHandlers<UseIX>(std::make_index_sequence<256>());
+static constexpr OpTable iyHandlers = makeHandlers<UseIY>(std::make_index_sequence<256>());
+
+
+// After a DD or FD prefix
+
+template<int Index>
+static void indexedOp()
+{
+	uint8_t op = readRam(reg.pc); ++reg.pc;
+	cycles += indexCycles[op];
+
+	if constexpr (Index == UseIX)
+		ixHandlers[op]();
+	else
+		iyHandlers[op]();
+}
+
+
+//-------------------------------------------------------------------------
+//
+// Interrupts. They're only taken between instructions, and not straight
+// after EI so that the usual EI, RET at the end of a handler returns
+// before the next one comes in.
+//
+// The maskable interrupt waits while interrupts are disabled, like a
+// device holding the line until it's served. In IM 0 the byte the device
+// put on the bus is run as an instruction, which has to be a single byte
+// one (normally an RST). IM 1 calls 38. In IM 2 the byte is the low half
+// of the address of a vector, with I the high half.
+//
+//-------------------------------------------------------------------------
+
+void raiseInt(uint8_t vector)
+{
+	pending |= IntRequest;
+	intVector = vector;
+}
+
+void raiseNMI()
+{
+	pending |= NmiRequest;
+}
+
+// Returns true if the step was taken up by an interrupt or by waiting at
+// a HALT. Kept out of line so that z80step() stays a jump to the handler.
+
+__attribute__((noinline)) static bool interrupt()
+{
+	if (pending & AfterEI)
+	{
+		pending &= ~AfterEI;
+		return false;
+	}
+
+	if (pending & NmiRequest)
+	{
+		pending &= ~(NmiRequest | Halted);
+		++interrupts;
+		reg.iff = (reg.iff & 1) << 1;		// IFF2 keeps IFF1 for RETN
+		push(reg.pc);
+		reg.pc = 0x66;
+		cycles += 11;
+		return true;
+	}
+
+	if ((pending & IntRequest) && (reg.iff & 1))
+	{
+		pending &= ~(IntRequest | Halted);
+		++interrupts;
+		reg.iff = 0;
+
+		switch (reg.im)
+		{
+		case 0:
+			cycles += mainCycles[intVector] + 2;
+			mainHandlers[intVector]();
+			break;
+		case 1:
+			push(reg.pc);
+			reg.pc = 0x38;
+			cycles += 13;
+			break;
+		default:
+			push(reg.pc);
+			reg.pc = readWord((reg.ir.high << 8) | intVector);
+			cycles += 19;
+		}
+
+		return true;
+	}
+
+	if (pending & Halted)
+	{
+		cycles += 4;			// HALT runs NOPs while it waits
+		return true;
+	}
+
+	return false;
+}
+
+
+void z80step()
+{
+	if (pending && interrupt())
+		return;
+
+	uint8_t op = readRam(reg.pc); ++reg.pc;
+	cycles += mainCycles[op];
+
+	mainHandlers[op]();
 }
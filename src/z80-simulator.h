@@ -0,0 +1,91 @@
+//-------------------------------------------------------------------------
+//
+// Interface to the Z80 microprocessor instruction emulator.
+//
+// The caller needs to supply readRam(), writeRam(), portIn() and
+// portOut(), everything else lives in z80-simulator.cpp.
+//
+//-------------------------------------------------------------------------
+
+#ifndef Z80_SIMULATOR_H
+#define Z80_SIMULATOR_H
+
+#include <stdint.h>
+
+// The server runs a separate machine on each of its threads, so it builds
+// everything with NASCOM_THREADS and the machine state becomes per thread.
+// Everything else keeps plain globals.
+
+#ifdef NASCOM_THREADS
+#define machine_local thread_local
+#else
+#define machine_local
+#endif
+
+extern "C" uint8_t readRam(uint16_t addr);
+extern "C" void    writeRam(uint16_t addr, uint8_t val);
+extern "C" uint8_t portIn(uint8_t port);
+extern "C" void    portOut(uint8_t port, uint8_t val);
+
+// The caller can also take over LDIR/LDDR and CPIR/CPDR. copyRam() copies
+// count bytes (1 to 64K) from from to to, a byte at a time upwards for a
+// step of 1 or downwards for -1, and returns the last byte copied.
+// findRam() reads from from the same way until it finds val, and returns
+// how many bytes it read. Either can turn the job down, returning -1 or 0
+// with nothing done, and the instruction then goes a byte at a time.
+
+extern "C" int      copyRam(uint16_t from, uint16_t to, unsigned count, int step);
+extern "C" unsigned findRam(uint16_t from, unsigned count, uint8_t val, int step);
+
+// Likewise INIR/INDR and OTIR/OTDR: move up to count bytes between port
+// and memory from addr on, returning how many were moved, or 0 to leave it
+// to portIn() and portOut() a byte at a time
+
+extern "C" unsigned portInBlock(uint8_t port, uint16_t addr, unsigned count, int step);
+extern "C" unsigned portOutBlock(uint8_t port, uint16_t addr, unsigned count, int step);
+
+// Put the processor into its power-on state (PC = 0, interrupts off)
+
+void z80reset();
+
+// Execute a single instruction, or take an interrupt. A HALT stays put
+// until an interrupt comes, with each step running for 4 T-states.
+
+void z80step();
+
+// Signal an interrupt, taken before the next instruction. The maskable one
+// waits while interrupts are disabled, and vector is what the device puts
+// on the bus: an RST (or other one byte instruction) in IM 0, and the low
+// byte of the vector table address in IM 2. IM 1 doesn't use it.
+
+void raiseInt(uint8_t vector = 0xff);
+void raiseNMI();
+
+// Processor state, for tools that watch the emulation
+
+struct Z80Registers
+{
+	uint16_t af, bc, de, hl;
+	uint16_t ix, iy, sp, pc;
+	uint16_t ir, iff;
+	uint16_t afAlt, bcAlt, deAlt, hlAlt;
+	uint8_t  im;			// Interrupt mode
+	uint8_t  pending;		// Interrupts not yet taken, and HALT
+	uint8_t  vector;		// The maskable interrupt's byte
+};
+
+uint16_t z80pc();
+uint16_t z80sp();
+uint64_t z80cycles();	// T-states since reset
+bool     z80halted();	// Parked at a HALT, PC is already past it
+uint64_t z80interrupts();	// Interrupts taken since reset. A step that takes
+							// one runs no instruction, it calls the handler.
+
+void z80getRegisters(Z80Registers &regs);
+
+// Load another machine's state, to switch between machines
+
+void z80setRegisters(const Z80Registers &regs);
+void z80setCycles(uint64_t count);
+
+#endif